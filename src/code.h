@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "hash.h"
 #include "lex.h"
 #include "types.h"
 
@@ -77,14 +78,16 @@ enum opcodes {
     OP_PUSHK0,  // Push K[0] on stack as value
     OP_PUSHK1,  // Push K[1] on stack as value
     OP_PUSHK2,  // Push K[2] on stack as value
-    OP_GBLA,    // Push address of global var K[IP+1] on stack
-    OP_GBLA0,   // Push address of global var K[0] on stack
-    OP_GBLA1,   // Push address of global var K[1] on stack
-    OP_GBLA2,   // Push address of global var K[2] on stack
-    OP_GBLV,    // Copy value of global var K[IP+1] onto stack
-    OP_GBLV0,   // Copy value of global var K[0] onto stack
-    OP_GBLV1,   // Copy value of global var K[1] onto stack
-    OP_GBLV2,   // Copy value of global var K[2] onto stack
+    OP_GBLA,    // Push address of global slot IP+1 on stack
+    OP_GBLA16,  // Push address of global slot ((IP+1)<<8) + (IP+2) on stack
+    OP_GBLA0,   // Push address of global slot 0 on stack
+    OP_GBLA1,   // Push address of global slot 1 on stack
+    OP_GBLA2,   // Push address of global slot 2 on stack
+    OP_GBLV,    // Copy value of global slot IP+1 onto stack
+    OP_GBLV16,  // Copy value of global slot ((IP+1)<<8) + (IP+2) onto stack
+    OP_GBLV0,   // Copy value of global slot 0 onto stack
+    OP_GBLV1,   // Copy value of global slot 1 onto stack
+    OP_GBLV2,   // Copy value of global slot 2 onto stack
     OP_LCLA,    // Push address of stack[FP+IP+1] on stack
     OP_LCLA0,   // Push address of stack[FP+0] on stack
     OP_LCLA1,   // Push address of stack[FP+1] on stack
@@ -117,7 +120,45 @@ enum opcodes {
     OP_SET,     // Assignment
     OP_PRINT1,  // Print value at SP[-1]
     OP_PRINT,   // Print (IP+1) values from stack
-    OP_EXIT     // exit(0)
+    OP_EXIT,    // exit(0)
+
+    // Type-specialized instructions. The VM rewrites generic
+    // instructions into these at runtime (see vm.c).
+    OP_IADD,    // Add (int, int)
+    OP_FADD,    // Add (float, float)
+    OP_ISUB,    // Subtract (int, int)
+    OP_FSUB,    // Subtract (float, float)
+    OP_IMUL,    // Multiply (int, int)
+    OP_FMUL,    // Multiply (float, float)
+    OP_IEQ,     // Equality (int, int)
+    OP_INE,     // Not equal (int, int)
+    OP_IGT,     // Greater-than (int, int)
+    OP_IGE,     // Greater-than or equal-to (int, int)
+    OP_ILT,     // Less-than (int, int)
+    OP_ILE,     // Less-than or equal-to (int, int)
+    OP_IADDX,   // Add assign (int, int)
+    OP_FADDX,   // Add assign (float, float)
+    OP_ISUBX,   // Subtract assign (int, int)
+    OP_FSUBX,   // Subtract assign (float, float)
+
+    // Superinstructions. Emitted only by the peephole pass (see
+    // c_peephole()).
+    OP_SETP,    // Assignment; pop
+    OP_EQJZ,    // Equality; jump if zero (2-byte offset)
+    OP_NEJZ,    // Not equal; jump if zero (2-byte offset)
+    OP_GTJZ,    // Greater-than; jump if zero (2-byte offset)
+    OP_GEJZ,    // Greater-than or equal-to; jump if zero (2-byte offset)
+    OP_LTJZ,    // Less-than; jump if zero (2-byte offset)
+    OP_LEJZ,    // Less-than or equal-to; jump if zero (2-byte offset)
+    OP_ADDLI,   // Push stack[FP+IP+1] + IP+2
+    OP_SUBLI,   // Push stack[FP+IP+1] - IP+2
+
+    // Counted loops over sequence literals (`for v in x..y:z`). The
+    // loop variable, iteration count and interval live in consecutive
+    // stack slots; no iterator is created.
+    OP_ITERN,   // Initialize a counted loop
+    OP_LOOPN8,  // Step counted loop and jump (1-byte offset)
+    OP_LOOPN16  // Step counted loop and jump (2-byte offset)
 };
 
 enum jumps {
@@ -128,6 +169,20 @@ enum jumps {
     XJNZ        // Pop stack OR jump if non-zero
 };
 
+enum iters {
+    ITER_V,     // for v in x
+    ITER_KV,    // for k,v in x
+    ITER_N      // for v in x..y:z (counted)
+};
+
+// Direct-threaded code word (see vm.c). Each instruction's label
+// address and decoded operands occupy the same offsets as the bytes
+// of the original instruction.
+typedef union {
+    void     *l; // Label address
+    intptr_t  o; // Decoded operand
+} rf_word;
+
 typedef struct {
     int      n;     // Number of bytes in bytecode array
     int      cap;   // Bytecode array capacity
@@ -135,14 +190,28 @@ typedef struct {
     int      nk;    // Number of constants in pool
     int      kcap;  // Constants pool capacity
     rf_val  *k;     // Constants pool
+    rf_word *tc;    // Direct-threaded code
 } rf_code;
 
+// Global symbol table, shared by every code object. Each global
+// variable referenced by the program is assigned a slot in the VM's
+// global array at compile time.
+typedef struct {
+    int      n;     // Number of slots
+    int      cap;
+    rf_str **id;    // Slot -> identifier
+    rf_htbl  slots; // Identifier -> slot
+} rf_symtab;
+
+extern rf_symtab c_symtab;
+
 void c_init(rf_code *);
 void c_push(rf_code *, uint8_t);
 void c_free(rf_code *);
 void c_fn_constant(rf_code *, rf_fn *);
 void c_constant(rf_code *, rf_token *);
 void c_global(rf_code *, rf_token *, int);
+int  c_global_slot(const char *);
 void c_local(rf_code *, int, int);
 void c_table(rf_code *, int);
 void c_index(rf_code *, int, int);
@@ -150,12 +219,14 @@ void c_prefix(rf_code *, int);
 void c_infix(rf_code *, int);
 void c_postfix(rf_code *, int);
 void c_jump(rf_code *, int, int);
-void c_loop(rf_code *, int);
+void c_loop(rf_code *, int, int);
 void c_sequence(rf_code *, int, int, int);
 void c_patch(rf_code *, int);
 int  c_prep_jump(rf_code *, int);
 int  c_prep_loop(rf_code *, int);
 void c_print(rf_code *, int);
 void c_return(rf_code *, int);
+void c_peephole(rf_code *);
+int  c_inst_len(rf_code *, int);
 
 #endif
@@ -10,8 +10,26 @@
 // Size of buffer used in l_char() and l_fmt()
 #define STR_BUF_SZ 0x1000
 
-// Size of VM stack
-// Currently statically allocated
-#define VM_STACK_SIZE 0x1000
+// Strings of up to this many bytes are interned when used as table
+// keys, constants or identifiers (see str.c)
+#define STR_INTERN_MAX 40
+
+// Repeated concatenation producing strings of at least this many
+// bytes appends to a shared buffer instead of copying (see str.c)
+#define STR_APPEND_MIN 64
+
+// Heap size (bytes) which triggers the first garbage collection.
+// The collector never schedules a collection below this size.
+#define GC_HEAP_MIN 0x100000
+
+// Heap growth factor. After each collection, the next collection is
+// triggered once the heap reaches GC_HEAP_GROWTH times the size of
+// the surviving heap.
+#define GC_HEAP_GROWTH 2
+
+// Initial size of VM stack (number of elements). The stack doubles in
+// size as needed, up to VM_STACK_MAX elements.
+#define VM_STACK_SIZE 0x100
+#define VM_STACK_MAX  0x1000000
 
 #endif
@@ -8,6 +8,7 @@ static struct {
     const char *mnemonic;
     int         arity;
 } opcode_info[] = {
+    [OP_ADDLI]   = { "addli",    2 },
     [OP_ADDX]    = { "addx",     0 },
     [OP_ADD]     = { "add",      0 },
     [OP_ANDX]    = { "andx",     0 },
@@ -17,30 +18,52 @@ static struct {
     [OP_CAT]     = { "cat",      0 },
     [OP_DIVX]    = { "divx",     0 },
     [OP_DIV]     = { "div",      0 },
+    [OP_EQJZ]    = { "eqjz",     2 },
     [OP_EQ]      = { "eq",       0 },
     [OP_EXIT]    = { "exit",     0 },
+    [OP_FADDX]   = { "faddx",    0 },
+    [OP_FADD]    = { "fadd",     0 },
     [OP_FLDA]    = { "flda",     0 },
     [OP_FLDV]    = { "fldv",     0 },
+    [OP_FMUL]    = { "fmul",     0 },
+    [OP_FSUBX]   = { "fsubx",    0 },
+    [OP_FSUB]    = { "fsub",     0 },
     [OP_GBLA0]   = { "gbla   0", 0 },
     [OP_GBLA1]   = { "gbla   1", 0 },
+    [OP_GBLA16]  = { "gbla",     2 },
     [OP_GBLA2]   = { "gbla   2", 0 },
     [OP_GBLA]    = { "gbla",     1 },
     [OP_GBLV0]   = { "gblv   0", 0 },
     [OP_GBLV1]   = { "gblv   1", 0 },
+    [OP_GBLV16]  = { "gblv",     2 },
     [OP_GBLV2]   = { "gblv   2", 0 },
     [OP_GBLV]    = { "gblv",     1 },
+    [OP_GEJZ]    = { "gejz",     2 },
     [OP_GE]      = { "ge",       0 },
+    [OP_GTJZ]    = { "gtjz",     2 },
     [OP_GT]      = { "gt",       0 },
+    [OP_IADDX]   = { "iaddx",    0 },
+    [OP_IADD]    = { "iadd",     0 },
     [OP_IDXA1]   = { "idxa",     0 },
     [OP_IDXA]    = { "idxa",     1 },
     [OP_IDXV1]   = { "idxv",     0 },
     [OP_IDXV]    = { "idxv",     1 },
+    [OP_IEQ]     = { "ieq",      0 },
+    [OP_IGE]     = { "ige",      0 },
+    [OP_IGT]     = { "igt",      0 },
+    [OP_ILE]     = { "ile",      0 },
+    [OP_ILT]     = { "ilt",      0 },
     [OP_IMM0]    = { "imm    0", 0 },
     [OP_IMM16]   = { "imm",      2 },
     [OP_IMM1]    = { "imm    1", 0 },
     [OP_IMM2]    = { "imm    2", 0 },
     [OP_IMM8]    = { "imm",      1 },
+    [OP_IMUL]    = { "imul",     0 },
+    [OP_INE]     = { "ine",      0 },
+    [OP_ISUBX]   = { "isubx",    0 },
+    [OP_ISUB]    = { "isub",     0 },
     [OP_ITERKV]  = { "iterkv",   2 },
+    [OP_ITERN]   = { "itern",    2 },
     [OP_ITERV]   = { "iterv",    2 },
     [OP_JMP16]   = { "jmp",      2 },
     [OP_JMP8]    = { "jmp",      1 },
@@ -56,11 +79,15 @@ static struct {
     [OP_LCLV1]   = { "lclv   1", 0 },
     [OP_LCLV2]   = { "lclv   2", 0 },
     [OP_LCLV]    = { "lclv",     1 },
+    [OP_LEJZ]    = { "lejz",     2 },
     [OP_LEN]     = { "len",      0 },
     [OP_LE]      = { "le",       0 },
     [OP_LNOT]    = { "lnot",     0 },
     [OP_LOOP16]  = { "loop",     2 },
     [OP_LOOP8]   = { "loop",     1 },
+    [OP_LOOPN16] = { "loopn",    2 },
+    [OP_LOOPN8]  = { "loopn",    1 },
+    [OP_LTJZ]    = { "ltjz",     2 },
     [OP_LT]      = { "lt",       0 },
     [OP_MATCH]   = { "match",    0 },
     [OP_MODX]    = { "modx",     0 },
@@ -68,6 +95,7 @@ static struct {
     [OP_MULX]    = { "mulx",     0 },
     [OP_MUL]     = { "mul",      0 },
     [OP_NEG]     = { "neg",      0 },
+    [OP_NEJZ]    = { "nejz",     2 },
     [OP_NE]      = { "ne",       0 },
     [OP_NMATCH]  = { "nmatch",   0 },
     [OP_NOT]     = { "not",      0 },
@@ -96,6 +124,7 @@ static struct {
     [OP_SEQF]    = { "seqf",     0 },
     [OP_SEQT]    = { "seqt",     0 },
     [OP_SEQ]     = { "seq",      0 },
+    [OP_SETP]    = { "setp",     0 },
     [OP_SET]     = { "set",      0 },
     [OP_SHLX]    = { "shlx",     0 },
     [OP_SHL]     = { "shl",      0 },
@@ -105,6 +134,7 @@ static struct {
     [OP_SSEQF]   = { "sseqf",    0 },
     [OP_SSEQT]   = { "sseqt",    0 },
     [OP_SSEQ]    = { "sseq",     0 },
+    [OP_SUBLI]   = { "subli",    2 },
     [OP_SUBX]    = { "subx",     0 },
     [OP_SUB]     = { "sub",      0 },
     [OP_TBL0]    = { "tbl    0", 0 },
@@ -129,12 +159,14 @@ static struct {
 #define INST1DEREF  "%*d: %02x %02x    %-6s %-6d // %s\n"
 #define INST1ADDR   "%*d: %02x %02x    %-6s %-6d // %d\n"
 #define INST2       "%*d: %02x %02x %02x %-6s %d\n"
+#define INST2DEREF  "%*d: %02x %02x %02x %-6s %-6d // %s\n"
 #define INST2ADDR   "%*d: %02x %02x %02x %-6s %-6d // %d\n"
+#define INST2OPND   "%*d: %02x %02x %02x %-6s %d %d\n"
 
-#define OPND(x)     (c->k[b1].u.x)
-#define OPND0(x)    (c->k[0].u.x)
-#define OPND1(x)    (c->k[1].u.x)
-#define OPND2(x)    (c->k[2].u.x)
+#define OPND(x)     (as_##x(&c->k[b1]))
+#define OPND0(x)    (as_##x(&c->k[0]))
+#define OPND1(x)    (as_##x(&c->k[1]))
+#define OPND2(x)    (as_##x(&c->k[2]))
 
 static int is_jump8(int op) {
     return op == OP_JMP8 || op == OP_JZ8 || op == OP_JNZ8 ||
@@ -144,7 +176,9 @@ static int is_jump8(int op) {
 static int is_jump16(int op) {
     return op == OP_JMP16 || op == OP_JZ16 || op == OP_JNZ16 ||
            op == OP_XJZ16 || op == OP_XJNZ16 ||
-           op == OP_ITERV || op == OP_ITERKV;
+           op == OP_ITERV || op == OP_ITERKV || op == OP_ITERN ||
+           op == OP_EQJZ  || op == OP_NEJZ   || op == OP_GTJZ ||
+           op == OP_GEJZ  || op == OP_LTJZ   || op == OP_LEJZ;
 }
 
 // TODO This function is way too big for its own good
@@ -161,21 +195,21 @@ static void d_code_obj(rf_code *c, int ipw) {
             switch (b0) {
             case OP_PUSHK:
             case OP_TBLK:
-                switch (c->k[b1].type) {
+                switch (type_of(&c->k[b1])) {
                 case TYPE_FLT:
-                    sprintf(s, "%g", OPND(f));
+                    sprintf(s, "%g", OPND(flt));
                     break;
                 case TYPE_INT:
-                    sprintf(s, "%"PRId64, OPND(i));
+                    sprintf(s, "%"PRId64, OPND(int));
                     break;
                 case TYPE_STR:
-                    sprintf(s, "\"%s\"", OPND(s->str));
+                    sprintf(s, "\"%s\"", OPND(str)->str);
                     break;
                 case TYPE_RE:
-                    sprintf(s, "regex: %p", OPND(r));
+                    sprintf(s, "regex: %p", OPND(re));
                     break;
                 case TYPE_RFN:
-                    sprintf(s, "fn: %p", OPND(fn));
+                    sprintf(s, "fn: %p", OPND(rfn));
                     break;
                 default:
                     break;
@@ -183,9 +217,17 @@ static void d_code_obj(rf_code *c, int ipw) {
                 printf(INST1DEREF, ipw, ip, b0, b1, OP_MNEMONIC, b1, s);
                 break;
             case OP_GBLA: case OP_GBLV:
-                sprintf(s, "%s", OPND(s->str));
+                sprintf(s, "%s", c_symtab.id[b1]->str);
                 printf(INST1DEREF, ipw, ip, b0, b1, OP_MNEMONIC, b1, s);
                 break;
+            case OP_GBLA16: case OP_GBLV16: {
+                int b2 = c->code[ip+2];
+                int a = (b1 << 8) + b2;
+                sprintf(s, "%s", c_symtab.id[a]->str);
+                printf(INST2DEREF, ipw, ip, b0, b1, b2, OP_MNEMONIC, a, s);
+                ip += 1;
+                break;
+            }
             default:
                 if (is_jump8(b0)) {
                     printf(INST1ADDR, ipw, ip, b0, b1, OP_MNEMONIC, (int8_t) b1, ip + (int8_t) b1);
@@ -195,14 +237,18 @@ static void d_code_obj(rf_code *c, int ipw) {
                     printf(INST2ADDR, ipw, ip, b0, b1, b2, OP_MNEMONIC,
                             a, ip + a);
                     ip += 1;
-                } else if (b0 == OP_LOOP8) {
+                } else if (b0 == OP_LOOP8 || b0 == OP_LOOPN8) {
                     printf(INST1ADDR, ipw, ip, b0, b1, OP_MNEMONIC, -b1, ip - (uint8_t) b1);
-                } else if (b0 == OP_LOOP16) {
+                } else if (b0 == OP_LOOP16 || b0 == OP_LOOPN16) {
                     int b2 = c->code[ip+2];
                     int a = (b1 << 8) + b2;
                     printf(INST2ADDR, ipw, ip, b0, b1, b2, OP_MNEMONIC,
                             -a, ip - a);
                     ip += 1;
+                } else if (b0 == OP_ADDLI || b0 == OP_SUBLI) {
+                    int b2 = c->code[ip+2];
+                    printf(INST2OPND, ipw, ip, b0, b1, b2, OP_MNEMONIC, b1, b2);
+                    ip += 1;
                 } else if (b0 == OP_IMM16) {
                     int b2 = c->code[ip+2];
                     int a = (b1 << 8) + b2;
@@ -218,21 +264,21 @@ static void d_code_obj(rf_code *c, int ipw) {
         } else if (b0 >= OP_PUSHK0 && b0 <= OP_GBLV2) {
             switch (b0) {
             case OP_PUSHK0:
-                switch (c->k[0].type) {
+                switch (type_of(&c->k[0])) {
                 case TYPE_FLT:
-                    sprintf(s, "%g", OPND0(f));
+                    sprintf(s, "%g", OPND0(flt));
                     break;
                 case TYPE_INT:
-                    sprintf(s, "%"PRId64, OPND0(i));
+                    sprintf(s, "%"PRId64, OPND0(int));
                     break;
                 case TYPE_STR:
-                    sprintf(s, "\"%s\"", OPND0(s->str));
+                    sprintf(s, "\"%s\"", OPND0(str)->str);
                     break;
                 case TYPE_RE:
-                    sprintf(s, "regex: %p", OPND0(r));
+                    sprintf(s, "regex: %p", OPND0(re));
                     break;
                 case TYPE_RFN:
-                    sprintf(s, "fn: %p", OPND0(fn));
+                    sprintf(s, "fn: %p", OPND0(rfn));
                     break;
                 default:
                     break;
@@ -240,21 +286,21 @@ static void d_code_obj(rf_code *c, int ipw) {
                 printf(INST0DEREF, ipw, ip, b0, OP_MNEMONIC, s);
                 break;
             case OP_PUSHK1:
-                switch (c->k[1].type) {
+                switch (type_of(&c->k[1])) {
                 case TYPE_FLT:
-                    sprintf(s, "%g", OPND1(f));
+                    sprintf(s, "%g", OPND1(flt));
                     break;
                 case TYPE_INT:
-                    sprintf(s, "%"PRId64, OPND1(i));
+                    sprintf(s, "%"PRId64, OPND1(int));
                     break;
                 case TYPE_STR:
-                    sprintf(s, "\"%s\"", OPND1(s->str));
+                    sprintf(s, "\"%s\"", OPND1(str)->str);
                     break;
                 case TYPE_RE:
-                    sprintf(s, "regex: %p", OPND1(r));
+                    sprintf(s, "regex: %p", OPND1(re));
                     break;
                 case TYPE_RFN:
-                    sprintf(s, "fn: %p", OPND1(fn));
+                    sprintf(s, "fn: %p", OPND1(rfn));
                     break;
                 default:
                     break;
@@ -262,21 +308,21 @@ static void d_code_obj(rf_code *c, int ipw) {
                 printf(INST0DEREF, ipw, ip, b0, OP_MNEMONIC, s);
                 break;
             case OP_PUSHK2:
-                switch (c->k[2].type) {
+                switch (type_of(&c->k[2])) {
                 case TYPE_FLT:
-                    sprintf(s, "%g", OPND2(f));
+                    sprintf(s, "%g", OPND2(flt));
                     break;
                 case TYPE_INT:
-                    sprintf(s, "%"PRId64, OPND2(i));
+                    sprintf(s, "%"PRId64, OPND2(int));
                     break;
                 case TYPE_STR:
-                    sprintf(s, "\"%s\"", OPND2(s->str));
+                    sprintf(s, "\"%s\"", OPND2(str)->str);
                     break;
                 case TYPE_RE:
-                    sprintf(s, "regex: %p", OPND2(r));
+                    sprintf(s, "regex: %p", OPND2(re));
                     break;
                 case TYPE_RFN:
-                    sprintf(s, "fn: %p", OPND2(fn));
+                    sprintf(s, "fn: %p", OPND2(rfn));
                     break;
                 default:
                     break;
@@ -284,15 +330,15 @@ static void d_code_obj(rf_code *c, int ipw) {
                 printf(INST0DEREF, ipw, ip, b0, OP_MNEMONIC, s);
                 break;
             case OP_GBLA0: case OP_GBLV0:
-                sprintf(s, "%s", OPND0(s->str));
+                sprintf(s, "%s", c_symtab.id[0]->str);
                 printf(INST0DEREF, ipw, ip, b0, OP_MNEMONIC, s);
                 break;
             case OP_GBLA1: case OP_GBLV1:
-                sprintf(s, "%s", OPND1(s->str));
+                sprintf(s, "%s", c_symtab.id[1]->str);
                 printf(INST0DEREF, ipw, ip, b0, OP_MNEMONIC, s);
                 break;
             case OP_GBLA2: case OP_GBLV2:
-                sprintf(s, "%s", OPND2(s->str));
+                sprintf(s, "%s", c_symtab.id[2]->str);
                 printf(INST0DEREF, ipw, ip, b0, OP_MNEMONIC, s);
                 break;
             default:
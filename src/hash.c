@@ -1,29 +1,44 @@
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "mem.h"
 #include "hash.h"
+#include "table.h"
 #include "types.h"
 #include "util.h"
 
-#include <stdio.h> // Debug purposes
-
-#define LOAD_FACTOR 0.6
+// Maximum load (including tombstones) of 7/8 before resizing
+#define MAX_LOAD(cap) ((cap) - (cap) / 8)
 
-#define set(f)   h->f = 1
 #define unset(f) h->f = 0
 
+// A hash is split in two: h1 selects the group where probing starts
+// and h2, 7 bits taken from the top of its product with a large odd
+// constant, is stored in the control byte. Keys whose hashes differ
+// only slightly (e.g. "k1", "k2", ...) then land in different groups
+// yet are still unlikely to share an h2.
+#define h1(x) (x)
+#define h2(x) ((uint8_t) (((uint32_t) (x) * 0x9e3779b1) >> 25))
+
 void h_init(rf_htbl *h) {
-    h->n     = 0;
-    h->an    = 0;
-    h->cap   = 0;
-    h->lx    = 0;
-    h->nodes = NULL;
+    h->n    = 0;
+    h->an   = 0;
+    h->nt   = 0;
+    h->cap  = 0;
+    h->lx   = 0;
+    h->ctrl = NULL;
+    h->e    = NULL;
 }
 
 uint32_t h_length(rf_htbl *h) {
     if (!h->lx)
         return h->n;
     uint32_t l = 0;
-    for (int i = 0; i < h->cap; ++i) {
-        if (h->nodes[i] && !is_null(h->nodes[i]->val))
+    for (uint32_t i = 0; i < h->cap; ++i) {
+        if (h_full(h, i) && !is_null(&h->e[i].val))
             ++l;
     }
     h->n = l;
@@ -31,132 +46,259 @@ uint32_t h_length(rf_htbl *h) {
     return l;
 }
 
-static ht_node *new_node(rf_str *k, rf_val *v) {
-    rf_str *nk = s_newstr(k->str, k->l, 0);
-    nk->hash = k->hash;
-    rf_val *nv;
-    switch (v->type) {
-    case TYPE_NULL: nv = v_newnull();      break;
-    case TYPE_INT:  nv = v_newint(v->u.i); break;
-    case TYPE_FLT:  nv = v_newflt(v->u.f); break;
-    case TYPE_STR:  nv = v_newstr(v->u.s); break;
-    case TYPE_TBL:
-        nv      = v_newtbl();
-        nv->u.t = v->u.t;
-        break;
-    case TYPE_RFN: case TYPE_CFN:
-        nv = v; // Don't allocate new functions
-        break;
-    default: break;
-    }
-    ht_node *e = malloc(sizeof(ht_node));
-    e->key = nk;
-    e->val = nv;
-    return e;
-}
-
-// Given a string's hash, return index of the element if it exists in the
-// table, or an index of a suitble empty slot
-static uint32_t node_slot(ht_node **e, uint32_t cap, uint32_t hash) {
-    cap -= 1;
-    uint32_t i = hash & cap;
-    while (e[i] && e[i]->key->hash != hash) {
-        i = (i + 1) & cap; // Linear probing
+// Free the hash part of a table. Key strings are owned by the garbage
+// collector.
+void h_free(rf_htbl *h) {
+    free(h->ctrl);
+    free(h->e);
+}
+
+// Bitmask of the control bytes in group `g` equal to `b`
+static inline uint32_t match_byte(uint8_t *g, uint8_t b) {
+#ifdef __SSE2__
+    __m128i c = _mm_loadu_si128((__m128i *) g);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8((char) b)));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < HT_GROUP; ++i)
+        m |= (uint32_t) (g[i] == b) << i;
+    return m;
+#endif
+}
+
+// Bitmask of the empty or deleted control bytes in group `g`
+static inline uint32_t match_free(uint8_t *g) {
+#ifdef __SSE2__
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((__m128i *) g));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < HT_GROUP; ++i)
+        m |= (uint32_t) (g[i] >> 7) << i;
+    return m;
+#endif
+}
+
+// Index of the lowest set bit of nonzero `m`
+static inline int lowest(uint32_t m) {
+#ifdef __GNUC__
+    return __builtin_ctz(m);
+#else
+    int i = 0;
+    while (!(m & 1)) {
+        m >>= 1;
+        ++i;
     }
     return i;
+#endif
+}
+
+// Reference types other than strings are keyed by identity. Returns
+// the object pointed to by `k`, or NULL for any other type.
+static inline void *key_ref(rf_val *k) {
+    switch (type_of(k)) {
+    case TYPE_RE:  return as_re(k);
+    case TYPE_SEQ: return as_seq(k);
+    case TYPE_TBL: return as_tbl(k);
+    case TYPE_RFN: return as_rfn(k);
+    case TYPE_CFN: return (void *) as_cfn(k);
+    default:       return NULL;
+    }
+}
+
+// Hash of key `k`. A string's hash is computed once and cached in
+// the string; any other key is hashed from its bits.
+static inline uint32_t key_hash(rf_val *k) {
+    switch (type_of(k)) {
+    case TYPE_INT:
+        return u_wordhash((uint64_t) as_int(k));
+    case TYPE_FLT: {
+        rf_flt   f = as_flt(k);
+        uint64_t b;
+        memcpy(&b, &f, sizeof b);
+        return u_wordhash(b);
+    }
+    case TYPE_STR: {
+        rf_str *s = as_str(k);
+        if (!s->hash)
+            s->hash = u_strhash(s->str, s->l);
+        return s->hash;
+    }
+    default:
+        return u_wordhash((uint64_t) (uintptr_t) key_ref(k));
+    }
+}
+
+// Keys of different types are never equal. Floats are compared by
+// their bits. Two interned strings are equal only if they're the same
+// string; otherwise string bytes are only compared when the hashes
+// (both known here) match.
+static inline int key_eq(rf_val *a, rf_val *b) {
+    if (type_of(a) != type_of(b))
+        return 0;
+    switch (type_of(a)) {
+    case TYPE_INT:
+        return as_int(a) == as_int(b);
+    case TYPE_FLT: {
+        rf_flt fa = as_flt(a), fb = as_flt(b);
+        return !memcmp(&fa, &fb, sizeof fa);
+    }
+    case TYPE_STR: {
+        rf_str *sa = as_str(a), *sb = as_str(b);
+        if (sa == sb)
+            return 1;
+        if (sa->interned && sb->interned)
+            return 0;
+        return sa->hash == sb->hash && sa->l == sb->l &&
+               !memcmp(sa->str, sb->str, sa->l);
+    }
+    default:
+        return key_ref(a) == key_ref(b);
+    }
 }
 
-static int exists(rf_htbl *h, rf_str *k) {
-    if (!h->cap) return 0;
-    if (!k->hash)
-        k->hash = u_strhash(k->str);
-    int i = node_slot(h->nodes, h->cap, k->hash);
-    return h->nodes[i] && h->nodes[i]->key->hash == k->hash;
-}
-
-#include <inttypes.h>
-
-int h_exists_int(rf_htbl *h, rf_int k) {
-    if (!h->cap) return 0;
-    char str[32];
-    size_t len = sprintf(str, "%"PRId64, k);
-    str[len] = '\0';
-    return exists(h, &(rf_str){len,u_strhash(str),str});
-}
-
-
-rf_val *h_lookup(rf_htbl *h, rf_str *k, int set) {
-    if (set) set(lx);
-    // If the table is empty, call h_insert, which allocates memory
-    if (!h->nodes)
-        return h_insert(h, k, v_newnull(), set);
-    if (!k->hash)
-        k->hash = u_strhash(k->str);
-    int i = node_slot(h->nodes, h->cap, k->hash);
-    if (!h->nodes[i])
-        return h_insert(h, k, v_newnull(), set);
-    return h->nodes[i]->val;
-}
-
-rf_val *h_insert(rf_htbl *h, rf_str *k, rf_val *v, int set) {
-    if (set) set(lx);
-    if (!k->hash)
-        k->hash = u_strhash(k->str);
-    // Evaluate hash table size
-    if ((h->cap * LOAD_FACTOR) <= h->an + 1) {
-        int new_cap = h->cap < 8 ? 8 : h->cap * 2;
-        ht_node **new_nodes = malloc(new_cap * sizeof(ht_node *));
-        for (int i = 0; i < new_cap; ++i)
-            new_nodes[i] = NULL;
-        int new_n  = 0;
-        int new_an = 0;
-        int old_an = h->an;
-        int j;
-        if (old_an) {
-            for (int i = 0; old_an && (i < h->cap); ++i) {
-                if (!h->nodes[i]) {
-                    continue;
-                } else {
-                    j = node_slot(new_nodes, new_cap, h->nodes[i]->key->hash);
-                    new_nodes[j] = h->nodes[i];
-                    ++new_an;
-                    --old_an;
-                    if (!is_null(h->nodes[i]->val))
-                        ++new_n;
-                }
-            }
+// Groups are probed in triangular order, which visits every group
+// when the number of groups is a power of 2
+#define probe(h, hash, g, mask, step) \
+    for (uint32_t mask = (h)->cap / HT_GROUP - 1, \
+                  g = h1(hash) & mask, step = 1; ; \
+         g = (g + step++) & mask)
+
+// Return the slot holding key `k` with hash `hash`, or -1 if there
+// isn't one. Probing stops at the first group with an empty slot.
+static int64_t find(rf_htbl *h, rf_val *k, uint32_t hash) {
+    if (!h->cap)
+        return -1;
+    probe(h, hash, g, mask, step) {
+        uint8_t *c = h->ctrl + g * HT_GROUP;
+        for (uint32_t m = match_byte(c, h2(hash)); m; m &= m - 1) {
+            uint32_t i = g * HT_GROUP + lowest(m);
+            if (key_eq(&h->e[i].key, k))
+                return i;
         }
-        free(h->nodes);
-        h->nodes = new_nodes;
-        h->n     = new_n;
-        h->an    = new_an;
-        h->cap   = new_cap;
+        if (match_byte(c, HT_EMPTY))
+            return -1;
     }
-    int i = node_slot(h->nodes, h->cap, k->hash);
-    if (!exists(h, k)) {
-        free(h->nodes[i]);
-        h->nodes[i] = new_node(k, v);
-        h->an++;
-        if (set || !is_null(v))
-            h->n++;
-    } else {
-        *h->nodes[i]->val = *v;
+}
+
+// Return the first empty or deleted slot along the probe sequence of
+// `hash`
+static uint32_t free_slot(rf_htbl *h, uint32_t hash) {
+    probe(h, hash, g, mask, step) {
+        uint32_t m = match_free(h->ctrl + g * HT_GROUP);
+        if (m)
+            return g * HT_GROUP + lowest(m);
+    }
+}
+
+// Rebuild the table with `cap` slots, dropping tombstones. Entries
+// move, so the VM is told where their values went (see t_moved).
+static void resize(rf_htbl *h, uint32_t cap) {
+    uint32_t  oc = h->cap;
+    uint8_t  *octrl = h->ctrl;
+    ht_entry *oe = h->e;
+    h->cap  = cap;
+    h->ctrl = malloc(cap);
+    h->e    = malloc(sizeof(ht_entry) * cap);
+    h->nt   = 0;
+    memset(h->ctrl, HT_EMPTY, cap);
+    m_grew((sizeof(ht_entry) + 1) * (cap - oc));
+    for (uint32_t i = 0; i < oc; ++i) {
+        if (octrl[i] >= HT_EMPTY)
+            continue;
+        uint32_t j = free_slot(h, key_hash(&oe[i].key));
+        h->ctrl[j] = octrl[i];
+        h->e[j] = oe[i];
+        if (t_moved)
+            t_moved((uintptr_t) &oe[i].val, &h->e[j].val, 1);
     }
-    return h->nodes[i]->val;
+    free(octrl);
+    free(oe);
+}
+
+// Return a pointer to the value for key `k`, or NULL if there is no
+// such entry
+rf_val *h_get(rf_htbl *h, rf_val *k) {
+    int64_t i = find(h, k, key_hash(k));
+    return i < 0 ? NULL : &h->e[i].val;
 }
 
-// Remove the key/value pair by nullifying its slot
-rf_val *h_delete(rf_htbl *h, rf_str *k) {
-    if (!h->nodes || !exists(h, k))
+// Shared null returned for missing keys (see h_lookup())
+static rf_val nil;
+
+// Return a pointer to the value for key `k`. If there is no such
+// entry, a lookup intending to set the value inserts a null one.
+// Otherwise the table is left untouched and a pointer to a shared null
+// is returned, which the caller must only read.
+rf_val *h_lookup(rf_htbl *h, rf_val *k, int set) {
+    rf_val *v = h_get(h, k);
+    if (v)
+        return v;
+    if (set)
+        return h_insert(h, k, &v_null);
+    nil = v_null;
+    return &nil;
+}
+
+// Would inserting a new key resize the table?
+int h_crowded(rf_htbl *h) {
+    return h->an + h->nt + 1 > MAX_LOAD(h->cap);
+}
+
+// Strings are immutable and owned by the garbage collector, so string
+// keys and values are stored as is
+rf_val *h_insert(rf_htbl *h, rf_val *k, rf_val *v) {
+    uint32_t hash = key_hash(k);
+    int64_t  i = find(h, k, hash);
+    if (i >= 0) {
+        h->n += !is_null(v) - !is_null(&h->e[i].val);
+        h->e[i].val = *v;
+        return &h->e[i].val;
+    }
+    if (h_crowded(h)) {
+        uint32_t cap = h->cap ? h->cap : HT_GROUP;
+        // Leave room to spare after dropping tombstones, but don't
+        // grow more than twofold
+        while (h->an + 1 > MAX_LOAD(cap) / 4 * 3)
+            cap *= 2;
+        resize(h, cap);
+    }
+    i = free_slot(h, hash);
+    if (h->ctrl[i] == HT_DELETED)
+        h->nt--;
+    h->ctrl[i] = h2(hash);
+    ht_entry *e = &h->e[i];
+    e->key = *k;
+    e->val = *v;
+    h->an++;
+    h->n += !is_null(v);
+    return &e->val;
+}
+
+// Remove the entry for key `k`. Returns a pointer to its value, which
+// remains valid until the next insertion, or NULL if there is no such
+// entry.
+//
+// The vacated slot becomes a tombstone, unless its group still has an
+// empty slot. In that case any probe reaching the group stops there
+// anyway, so the slot can be marked empty without breaking the probe
+// sequence of any other key.
+rf_val *h_delete(rf_htbl *h, rf_val *k) {
+    int64_t i = find(h, k, key_hash(k));
+    if (i < 0)
         return NULL;
-    if (!k->hash)
-        k->hash = u_strhash(k->str);
-    int slot = node_slot(h->nodes, h->cap, k->hash);
-    rf_val *v = h->nodes[slot]->val;
+    h_remove(h, i);
+    return &h->e[i].val;
+}
+
+// Remove the entry in slot `i`, which must be full. See h_delete().
+void h_remove(rf_htbl *h, uint32_t i) {
+    if (match_byte(h->ctrl + (i & ~(HT_GROUP - 1)), HT_EMPTY)) {
+        h->ctrl[i] = HT_EMPTY;
+    } else {
+        h->ctrl[i] = HT_DELETED;
+        h->nt++;
+    }
     h->an--;
-    if (!is_null(v))
+    if (!is_null(&h->e[i].val))
         h->n--;
-    m_freestr(h->nodes[slot]->key);
-    h->nodes[slot] = NULL;
-    return v;
 }
@@ -3,24 +3,45 @@
 
 #include "types.h"
 
+// Keys are never null. A table's hash part holds keys normalized by
+// t_lookup(): ints outside its array part, non-integral floats (NaN
+// only as one canonical NaN), strings which aren't entirely a number
+// (interned, if short), and regexes, sequences, tables and functions,
+// which are keyed by identity (see key_ref() in hash.c).
 typedef struct {
-    rf_str *key;
-    rf_val *val;
-} ht_node;
+    rf_val key;
+    rf_val val;
+} ht_entry;
 
+// Open-addressing hash table in the style of Abseil's "Swiss tables".
+// Entries are stored inline. Each slot has a control byte which is
+// either HT_EMPTY, HT_DELETED (tombstone) or, for an occupied slot,
+// 7 bits of its key's hash. Slots are probed a group of
+// HT_GROUP control bytes at a time.
 typedef struct {
-    uint32_t n;
-    uint32_t an;
-    uint32_t cap;
+    uint32_t  n;     // Number of entries with non-null values
+    uint32_t  an;    // Number of entries
+    uint32_t  nt;    // Number of tombstones
+    uint32_t  cap;   // Number of slots (0 or a power of 2 >= HT_GROUP)
     int lx: 1;
-    ht_node **nodes;
+    uint8_t  *ctrl;
+    ht_entry *e;
 } rf_htbl;
 
+#define HT_GROUP   16
+#define HT_EMPTY   0x80
+#define HT_DELETED 0xfe
+
+#define h_full(h,i) ((h)->ctrl[i] < HT_EMPTY)
+
 void      h_init(rf_htbl *);
+void      h_free(rf_htbl *);
 uint32_t  h_length(rf_htbl *);
-int       h_exists_int(rf_htbl *, rf_int);
-rf_val   *h_lookup(rf_htbl *, rf_str *, int);
-rf_val   *h_insert(rf_htbl *, rf_str *, rf_val *, int);
-rf_val   *h_delete(rf_htbl *, rf_str *);
+rf_val   *h_get(rf_htbl *, rf_val *);
+rf_val   *h_lookup(rf_htbl *, rf_val *, int);
+rf_val   *h_insert(rf_htbl *, rf_val *, rf_val *);
+rf_val   *h_delete(rf_htbl *, rf_val *);
+void      h_remove(rf_htbl *, uint32_t);
+int       h_crowded(rf_htbl *);
 
 #endif
@@ -2,7 +2,11 @@
 
 #define z_case(l)   L_##l:
 #define z_break     dispatch()
+#ifdef VM_THREADED
+#define dispatch()  goto *ip->l
+#else
 #define dispatch()  goto *dispatch_labels[*ip]
+#endif
 
 static void *dispatch_labels[] = {
     &&L_JMP8,
@@ -75,10 +79,12 @@ static void *dispatch_labels[] = {
     &&L_PUSHK1,
     &&L_PUSHK2,
     &&L_GBLA,
+    &&L_GBLA16,
     &&L_GBLA0,
     &&L_GBLA1,
     &&L_GBLA2,
     &&L_GBLV,
+    &&L_GBLV16,
     &&L_GBLV0,
     &&L_GBLV1,
     &&L_GBLV2,
@@ -114,5 +120,33 @@ static void *dispatch_labels[] = {
     &&L_SET,
     &&L_PRINT1,
     &&L_PRINT,
-    &&L_EXIT
+    &&L_EXIT,
+    &&L_IADD,
+    &&L_FADD,
+    &&L_ISUB,
+    &&L_FSUB,
+    &&L_IMUL,
+    &&L_FMUL,
+    &&L_IEQ,
+    &&L_INE,
+    &&L_IGT,
+    &&L_IGE,
+    &&L_ILT,
+    &&L_ILE,
+    &&L_IADDX,
+    &&L_FADDX,
+    &&L_ISUBX,
+    &&L_FSUBX,
+    &&L_SETP,
+    &&L_EQJZ,
+    &&L_NEJZ,
+    &&L_GTJZ,
+    &&L_GEJZ,
+    &&L_LTJZ,
+    &&L_LEJZ,
+    &&L_ADDLI,
+    &&L_SUBLI,
+    &&L_ITERN,
+    &&L_LOOPN8,
+    &&L_LOOPN16
 };
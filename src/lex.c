@@ -311,7 +311,7 @@ re_start:
         adv();
     }
     int errcode;
-    rf_re *r = re_compile(x->buf.c, flags, &errcode);
+    rf_re *r = re_compile(x->buf.c, x->buf.n, flags, &errcode);
 
     // Regex compilation error handling
     if (errcode != 100) {
@@ -600,7 +600,7 @@ int x_adv(rf_lexer *x) {
 
     // Free previous string object
     if (x->tk.kind == TK_STR || x->tk.kind == TK_ID) {
-        m_freestr(x->tk.lexeme.s);
+        s_free(x->tk.lexeme.s);
     } else if (x->tk.kind == TK_EOI)
         return 1;
 
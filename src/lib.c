@@ -7,6 +7,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "code.h"
 #include "conf.h"
 #include "fn.h"
 #include "lib.h"
@@ -23,7 +24,7 @@ static void err(const char *msg) {
 // abs(x)
 static int l_abs(rf_val *fp, int argc) {
     if (is_int(fp))
-        assign_int(fp-1, llabs(fp->u.i));
+        assign_int(fp-1, llabs(as_int(fp)));
     else
         assign_flt(fp-1, fabs(fltval(fp)));
     return 1;
@@ -134,9 +135,9 @@ static int l_rand(rf_val *fp, int argc) {
     // If first argument is a range/sequence, ignore any succeeding
     // args
     else if (is_seq(fp)) {
-        int64_t from = fp->u.q->from;
-        int64_t to   = fp->u.q->to;
-        int64_t itvl = fp->u.q->itvl;
+        int64_t from = as_seq(fp)->from;
+        int64_t to   = as_seq(fp)->to;
+        int64_t itvl = as_seq(fp)->itvl;
         uint64_t range, offset;
         if (from < to) {
             //           <<<
@@ -231,7 +232,7 @@ static int l_srand(rf_val *fp, int argc) {
         prng_seed(0);
     else
         // Seed the PRNG with whatever 64 bits are in the rf_val union
-        prng_seed(fp->u.i);
+        prng_seed(as_int(fp));
     return 0;
 }
 
@@ -247,13 +248,13 @@ static int l_srand(rf_val *fp, int argc) {
 static int l_byte(rf_val *fp, int argc) {
     int idx = argc > 1 ? intval(fp+1) : 0;
     if (is_str(fp)) {
-        if (idx > fp->u.s->l)
-            idx = fp->u.s->l;
-        assign_int(fp-1, (uint8_t) fp->u.s->str[idx]);
+        if (idx > as_str(fp)->l)
+            idx = as_str(fp)->l;
+        assign_int(fp-1, (uint8_t) as_str(fp)->str[idx]);
     } else if (is_rfn(fp)) {
-        if (idx > fp->u.fn->code->n)
-            idx = fp->u.fn->code->n;
-        assign_int(fp-1, fp->u.fn->code->code[idx]);
+        if (idx > as_rfn(fp)->code->n)
+            idx = as_rfn(fp)->code->n;
+        assign_int(fp-1, as_rfn(fp)->code->code[idx]);
     } else {
         return 0;
     }
@@ -299,12 +300,23 @@ static int l_char(rf_val *fp, int argc) {
     }
 
 // %s
-#define fmt_str(b, n, s) \
+// The string is copied by its length `l`, so it may hold null bytes
+#define fmt_str(b, n, s, l) { \
+    size_t sl  = prec >= 0 && (size_t) prec < (l) ? (size_t) prec : (l); \
+    size_t pad = width > 0 && (size_t) width > sl ? width - sl : 0; \
+    if (n + sl + pad >= STR_BUF_SZ) \
+        err("[fmt] string length exceeds maximum buffer size"); \
+    if (!(flags & FMT_LEFT)) { \
+        memset(b + n, ' ', pad); \
+        n += pad; \
+    } \
+    memcpy(b + n, s, sl); \
+    n += sl; \
     if (flags & FMT_LEFT) { \
-        n += sprintf(b + n, "%-*.*s", width, prec, s); \
-    } else { \
-        n += sprintf(b + n, "%*.*s", width, prec, s); \
-    }
+        memset(b + n, ' ', pad); \
+        n += pad; \
+    } \
+}
 
 // Signed fmt conversions: floats, decimal integers
 // NOTE: gcc complains about `0` flag with precision
@@ -411,12 +423,13 @@ static int l_fmt(rf_val *fp, int argc) {
     --argc;
     int arg = 1;
 
-    const char *fstr = fp->u.s->str;
+    const char *fstr = as_str(fp)->str;
+    const char *fend = fstr + as_str(fp)->l;
 
     char buf[STR_BUF_SZ];
     int  n = 0;
 
-    while (*fstr && argc && n <= STR_BUF_SZ) {
+    while (fstr < fend && argc && n <= STR_BUF_SZ) {
         if (*fstr != '%') {
             buf[n++] = *fstr++;
             continue;
@@ -589,7 +602,7 @@ redir_flt:
         case 's':
             if (argc--) {
                 if (is_str(fp+arg)) {
-                    fmt_str(buf, n, fp[arg].u.s->str);
+                    fmt_str(buf, n, as_str(&fp[arg])->str, as_str(&fp[arg])->l);
                 } else if (is_int(fp+arg)) {
                     goto redir_int;
                 } else if (is_flt(fp+arg)) {
@@ -598,7 +611,7 @@ redir_flt:
 
                 // TODO handle other types
                 else {
-                    fmt_str(buf, n, "");
+                    fmt_str(buf, n, "", 0);
                 }
                 ++arg;
             }
@@ -613,7 +626,7 @@ redir_flt:
     }
 
     // Copy rest of string after exhausting user-provided args
-    while (*fstr && n <= STR_BUF_SZ) {
+    while (fstr < fend && n <= STR_BUF_SZ) {
         buf[n++] = *fstr++;
     }
 
@@ -622,9 +635,12 @@ redir_flt:
 }
 
 static int xsub(rf_val *fp, int argc, int flags) {
-    char  *s;
-    rf_re *p;
-    char  *r;
+    char   *s;
+    size_t  sl;
+    rf_re  *p;
+    char   *r;
+    size_t  rl = 0;
+    int     tp = !is_re(fp+1); // Free temporary pattern?
 
     char temp_s[32];
     char temp_r[32];
@@ -632,54 +648,54 @@ static int xsub(rf_val *fp, int argc, int flags) {
     // String `s`
     if (!is_str(fp)) {
         if (is_int(fp))
-            u_int2str(fp->u.i, temp_s, 32);
+            sl = u_int2str(as_int(fp), temp_s, 32);
         else if (is_flt(fp))
-            u_flt2str(fp->u.f, temp_s, 32);
+            sl = u_flt2str(as_flt(fp), temp_s, 32);
         else
             return 0;
         s = temp_s;
     } else {
-        s = fp->u.s->str;
+        s  = as_str(fp)->str;
+        sl = as_str(fp)->l;
     }
 
     // Pattern `p`
     if (!is_re(fp+1)) {
         int errcode;
         if (is_num(fp+1)) {
-            char temp_p[32];
+            char   temp_p[32];
+            size_t pl;
             if (is_int(fp+1))
-                u_int2str(fp[1].u.i, temp_p, 32);
-            else if (is_flt(fp+1))
-                u_flt2str(fp[1].u.f, temp_p, 32);
-            p = re_compile(temp_p, 0, &errcode);
+                pl = u_int2str(as_int(&fp[1]), temp_p, 32);
+            else
+                pl = u_flt2str(as_flt(&fp[1]), temp_p, 32);
+            p = re_compile(temp_p, pl, 0, &errcode);
         } else if (is_str(fp+1)) {
-            p = re_compile(fp[1].u.s->str, 0, &errcode);
+            p = re_compile(as_str(&fp[1])->str, as_str(&fp[1])->l, 0, &errcode);
         } else {
             return 0;
         }
     } else {
-        p = fp[1].u.r;
+        p = as_re(&fp[1]);
     }
 
     // If replacement `r` provided
     if (argc > 2) {
         if (!is_str(fp+2)) {
             if (is_int(fp+2))
-                u_int2str(fp[2].u.i, temp_r, 32);
+                rl = u_int2str(as_int(&fp[2]), temp_r, 32);
             else if (is_flt(fp+2))
-                u_flt2str(fp[2].u.f, temp_r, 32);
-            else
-                temp_r[0] = '\0';
+                rl = u_flt2str(as_flt(&fp[2]), temp_r, 32);
             r = temp_r;
         } else {
-            r = fp[2].u.s->str;
+            r  = as_str(&fp[2])->str;
+            rl = as_str(&fp[2])->l;
         }
     }
 
     // Otherwise, treat `r` as an empty string, effectively deleting
     // substrings matching `p` from `s`.
     else {
-        temp_r[0] = '\0';
         r = temp_r;
     }
 
@@ -696,7 +712,7 @@ static int xsub(rf_val *fp, int argc, int flags) {
     int m_res = pcre2_match(
             p,
             (PCRE2_SPTR) s,
-            PCRE2_ZERO_TERMINATED,
+            sl,
             0,
             0,
             md,
@@ -706,20 +722,22 @@ static int xsub(rf_val *fp, int argc, int flags) {
     int res = pcre2_substitute(
             p,                      // Compiled regex
             (PCRE2_SPTR) s,         // Original string pointer
-            PCRE2_ZERO_TERMINATED,  // Original string length
+            sl,                     // Original string length
             0,                      // Start offset
             PCRE2_SUBSTITUTE_MATCHED
             | flags,                // Options/flags
             md,                     // Match data block
             NULL,                   // Match context
             (PCRE2_SPTR) r,         // Replacement string pointer
-            PCRE2_ZERO_TERMINATED,  // Replacement string length
+            rl,                     // Replacement string length
             (PCRE2_UCHAR *) buf,    // Buffer for new string
             &n);                    // Buffer size (overwritten w/ length)
 
     // Store capture substrings in the global fields table
     re_store_numbered_captures(md);
     pcre2_match_data_free(md);
+    if (tp)
+        re_free(p);
     assign_str(fp-1, s_newstr(buf, n, 0));
     return 1;
 }
@@ -745,14 +763,11 @@ static int l_hex(rf_val *fp, int argc) {
 }
 
 static int allxcase(rf_val *fp, int c) {
-    size_t len = fp->u.s->l;
-    char str[len + 1];
-    for (int i = 0; i < len; ++i) {
-        str[i] = c ? toupper(fp->u.s->str[i])
-                   : tolower(fp->u.s->str[i]);
-    }
-    str[len] = '\0';
-    assign_str(fp-1, s_newstr(str, len, 0));
+    rf_str *s = as_str(fp);
+    rf_str *x = s_alloc(s->l);
+    for (size_t i = 0; i < s->l; ++i)
+        x->str[i] = c ? toupper(s->str[i]) : tolower(s->str[i]);
+    assign_str(fp-1, x);
     return 1;
 }
 
@@ -771,9 +786,9 @@ static int l_lower(rf_val *fp, int argc) {
 static int l_num(rf_val *fp, int argc) {
     if (!is_str(fp)) {
         if (is_int(fp)) {
-            assign_int(fp-1, fp->u.i);
+            assign_int(fp-1, as_int(fp));
         } else if (is_flt(fp)) {
-            assign_flt(fp-1, fp->u.f);
+            assign_flt(fp-1, as_flt(fp));
         } else {
             assign_int(fp-1, 0);
         }
@@ -784,7 +799,7 @@ static int l_num(rf_val *fp, int argc) {
         base = intval(fp+1);
     char *end;
     errno = 0;
-    rf_int i = u_str2i64(fp->u.s->str, &end, base);
+    rf_int i = u_str2i64(as_str(fp)->str, &end, base);
     if (errno == ERANGE || isdigit(*end))
         goto ret_flt;
     if (*end == '.') {
@@ -799,7 +814,7 @@ static int l_num(rf_val *fp, int argc) {
     assign_int(fp-1, i);
     return 1;
 ret_flt:
-    assign_flt(fp-1, u_str2d(fp->u.s->str, &end, base));
+    assign_flt(fp-1, u_str2d(as_str(fp)->str, &end, base));
     return 1;
 }
 
@@ -815,81 +830,78 @@ static int l_split(rf_val *fp, int argc) {
     char temp_s[20];
     if (!is_str(fp)) {
         if (is_int(fp))
-            len = sprintf(temp_s, "%"PRId64, fp->u.i);
+            len = sprintf(temp_s, "%"PRId64, as_int(fp));
         else if (is_flt(fp))
-            len = sprintf(temp_s, "%g", fp->u.f);
+            len = sprintf(temp_s, "%g", as_flt(fp));
         else
             return 0;
         temp_s[len] = '\0';
         str = temp_s;
     } else {
-        str = fp->u.s->str;
-        len = fp->u.s->l;
+        str = as_str(fp)->str;
+        len = as_str(fp)->l;
     }
     rf_str *s;
     rf_val v;
-    rf_val *tbl = v_newtbl();
+    rf_tbl *tbl = t_newtbl();
     rf_re *delim;
+    int tp = 1; // Free temporary delimiter pattern?
     int errcode = 0;
     if (argc < 2) {
-        delim = re_compile("\\s+", 0, &errcode);
+        delim = re_compile("\\s+", 3, 0, &errcode);
     } else if (!is_re(fp+1)) {
-        char temp[32];
-        switch (fp[1].type) {
-        case TYPE_INT: u_int2str(fp[1].u.i, temp, 32); break;
-        case TYPE_FLT: u_flt2str(fp[1].u.f, temp, 32); break;
+        char   temp[32];
+        size_t tl;
+        switch (type_of(&fp[1])) {
+        case TYPE_INT: tl = u_int2str(as_int(&fp[1]), temp, 32); break;
+        case TYPE_FLT: tl = u_flt2str(as_flt(&fp[1]), temp, 32); break;
         case TYPE_STR:
-            if (!fp[1].u.s->l)
+            if (!as_str(&fp[1])->l)
                 goto split_chars;
-            delim = re_compile(fp[1].u.s->str, 0, &errcode);
+            delim = re_compile(as_str(&fp[1])->str, as_str(&fp[1])->l, 0, &errcode);
             goto do_split;
         default:
             goto split_chars;
         }
-        delim = re_compile(temp, 0, &errcode);
+        delim = re_compile(temp, tl, 0, &errcode);
     } else {
-        delim = fp[1].u.r;
+        delim = as_re(&fp[1]);
+        tp = 0;
     }
 
-    // Split on regular expression
+    // Split on regular expression. Each field is the span between two
+    // consecutive matches, so the string may contain null bytes. Empty
+    // matches are handled the way a global substitution would: retry
+    // at the same offset for a nonempty match, otherwise step over one
+    // byte.
 do_split: {
-    char buf[STR_BUF_SZ];
-    char *p = buf;
-    size_t n = STR_BUF_SZ;
-    char *sentinel = "\0";
-    int rc = pcre2_substitute(
-            delim,
-            (PCRE2_SPTR) str,
-            PCRE2_ZERO_TERMINATED,
-            0,
-            PCRE2_SUBSTITUTE_GLOBAL,
-            NULL,
-            NULL,
-            (PCRE2_SPTR) sentinel,
-            1,
-            (PCRE2_UCHAR *) buf,
-            &n);
-    n += 1;
-    // Extra null terminator, since the '\0' at buf[n] is a sentinel
-    // value
-    buf[n] = '\0';
-    for (rf_int i = 0; n > 0; ++i) {
-        // Insert an empty string when the delimiter produces
-        // consecutive sentinel values
-        if (!*p) {
-            s = s_newstr("", 0, 0);
-            ++p;
-            --n;
-        } else {
-            size_t l = strlen(p);
-            s = s_newstr(p, l, 0);
-            p += l + 1;
-            n -= l + 1;
+    pcre2_match_data *md = pcre2_match_data_create_from_pattern(delim, NULL);
+    PCRE2_SIZE *ov = pcre2_get_ovector_pointer(md);
+    size_t  from = 0, off = 0;
+    rf_int  i = 0;
+    uint32_t opts = 0;
+    while (off <= len) {
+        int rc = pcre2_match(delim, (PCRE2_SPTR) str, len, off, opts, md, NULL);
+        if (rc < 0) {
+            if (!opts)
+                break;
+            opts = 0;
+            ++off;
+            continue;
         }
-        v = (rf_val) {TYPE_STR, .u.s = s};
-        t_insert_int(tbl->u.t, i, &v, 1, 1);
+        s = s_newstr(str + from, ov[0] - from, 0);
+        v = v_str(s);
+        t_insert_int(tbl, i++, &v, 1);
+        from = off = ov[1];
+        opts = ov[0] == ov[1] ? PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED : 0;
     }
-    fp[-1] = *tbl;
+    pcre2_match_data_free(md);
+    if (tp)
+        re_free(delim);
+    s = s_newstr(str + from, len - from, 0);
+    v = v_str(s);
+    t_insert_int(tbl, i, &v, 1);
+    fp[-1] = v_tbl(tbl);
     return 1;
     }
 
@@ -897,10 +909,10 @@ do_split: {
 split_chars: {
     for (rf_int i = 0; i < len; ++i) {
         s = s_newstr(str + i, 1, 0);
-        v = (rf_val) {TYPE_STR, .u.s = s};
-        t_insert_int(tbl->u.t, i, &v, 1, 1);
+        v = v_str(s);
+        t_insert_int(tbl, i, &v, 1);
     }
-    fp[-1] = *tbl;
+    fp[-1] = v_tbl(tbl);
     return 1;
     }
 }
@@ -918,7 +930,7 @@ static int l_type(rf_val *fp, int argc) {
         return 0;
     char *str;
     size_t len = 0;
-    switch (fp->type) {
+    switch (type_of(fp)) {
     case TYPE_NULL: str = "null";     len = 4; break;
     case TYPE_INT:  str = "int";      len = 3; break;
     case TYPE_FLT:  str = "float";    len = 5; break;
@@ -974,13 +986,14 @@ static struct {
     { NULL,    { 0, NULL }    }
 };
 
-void l_register(rf_htbl *g) {
+// Assign each library function referenced by the program to its
+// global slot
+void l_register(rf_val *g) {
     // Initialize the PRNG with the current time
     prng_seed(time(0));
     for (int i = 0; lib_fn[i].name; ++i) {
-        rf_str *s  = s_newstr(lib_fn[i].name, strlen(lib_fn[i].name), 1);
-        rf_val *fn = malloc(sizeof(rf_val));
-        *fn        = (rf_val) {TYPE_CFN, .u.cfn = &lib_fn[i].fn};
-        h_insert(g, s, fn, 1);
+        int slot = c_global_slot(lib_fn[i].name);
+        if (slot >= 0)
+            g[slot] = v_cfn(&lib_fn[i].fn);
     }
 }
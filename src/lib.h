@@ -1,7 +1,6 @@
 #ifndef LIB_H
 #define LIB_H
 
-#include "hash.h"
 #include "types.h"
 
 // Each library function takes a frame pointer and an argument count,
@@ -20,6 +19,6 @@ struct c_fn {
     rf_lib_fn fn;
 };
 
-void l_register(rf_htbl *);
+void l_register(rf_val *);
 
 #endif
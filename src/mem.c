@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "conf.h"
+#include "mem.h"
+#include "table.h"
+
+rf_gc m_gc;
+
+// Precise, non-moving mark-and-sweep collector
+//
+// Every string, sequence and table allocated while the VM is running
+// is linked into m_gc.objs. Objects allocated before then (constants,
+// identifiers, library function names) are never tracked and live for
+// the duration of the program.
+//
+// Collections are only ever triggered by the VM at safe points (see
+// vm.c), where every live object is reachable from the VM's roots.
+// Rather than clearing mark bits after each sweep, the mark epoch
+// alternates between collections; an object is marked iff its mark
+// equals the current epoch. The only untracked tables (`argv` and
+// `fldv`) are roots, so they are reached and re-marked on every
+// collection without any extra bookkeeping.
+
+static size_t obj_size(rf_obj *o) {
+    switch (o->type) {
+    case TYPE_STR:
+        // Bytes in a shared buffer aren't counted per string
+        return sizeof(rf_str) + (((rf_str *) o)->shared ? 0 : ((rf_str *) o)->l + 1);
+    case TYPE_SEQ: return sizeof(rf_seq);
+    case TYPE_TBL: {
+        rf_tbl *t = (rf_tbl *) o;
+        return sizeof(rf_tbl) + sizeof(rf_htbl) + sizeof(rf_val) +
+               sizeof(rf_val) * t->cap +
+               (sizeof(ht_entry) + 1) * t->h->cap;
+    }
+#ifdef NAN_BOXING
+    case TYPE_INT: return sizeof(rf_bint);
+#endif
+    default:       return 0;
+    }
+}
+
+void m_init(void) {
+    m_gc.on     = 1;
+    m_gc.epoch  = 1;
+    m_gc.objs   = NULL;
+    m_gc.n      = 0;
+    m_gc.bytes  = 0;
+    m_gc.next   = GC_HEAP_MIN;
+    m_gc.ncoll  = 0;
+    m_gc.nfreed = 0;
+    m_gc.bfreed = 0;
+    m_gc.peak   = 0;
+    m_gc.secs   = 0;
+}
+
+// Link a newly-allocated object into the collector's list. Objects
+// are only tracked once the VM has initialized the collector.
+void m_track(rf_obj *o, int type) {
+    o->type = type;
+    o->mark = 0;
+    o->next = NULL;
+    if (!m_gc.on)
+        return;
+    o->next    = m_gc.objs;
+    m_gc.objs  = o;
+    m_gc.n    += 1;
+    m_gc.bytes += obj_size(o);
+}
+
+#define is_marked(o) ((o)->mark == m_gc.epoch)
+#define mark(o)      ((o)->mark = m_gc.epoch)
+
+void m_markstr(rf_str *s) {
+    mark(&s->o);
+}
+
+void m_markval(rf_val *v) {
+    switch (type_of(v)) {
+    case TYPE_STR: mark(&as_strobj(v)->o); break;
+    case TYPE_SEQ: mark(&as_seq(v)->o);    break;
+    case TYPE_TBL: m_marktbl(as_tbl(v));   break;
+#ifdef NAN_BOXING
+    case TYPE_INT: if (is_bint(v)) mark(&as_bint(v)->o); break;
+#endif
+    default: break;
+    }
+}
+
+void m_markhtbl(rf_htbl *h) {
+    for (uint32_t i = 0; i < h->cap; ++i) {
+        if (!h_full(h, i))
+            continue;
+        m_markval(&h->e[i].key);
+        m_markval(&h->e[i].val);
+    }
+}
+
+void m_marktbl(rf_tbl *t) {
+    if (is_marked(&t->o))
+        return;
+    mark(&t->o);
+    for (int i = 0; i < t->cap; ++i)
+        m_markval(&t->v[i]);
+    m_markval(t->nullv);
+    m_markhtbl(t->h);
+}
+
+static void free_obj(rf_obj *o) {
+    switch (o->type) {
+    case TYPE_STR: s_free((rf_str *) o);      break;
+    case TYPE_SEQ: free(o);                   break;
+#ifdef NAN_BOXING
+    case TYPE_INT: free(o);                   break;
+#endif
+    case TYPE_TBL: t_free((rf_tbl *) o);      break;
+    default: break;
+    }
+}
+
+// Free every tracked object not marked during the current
+// collection
+static void sweep(void) {
+    size_t  bytes = 0;
+    rf_obj **p = &m_gc.objs;
+    if (m_gc.bytes > m_gc.peak)
+        m_gc.peak = m_gc.bytes;
+    while (*p) {
+        rf_obj *o = *p;
+        if (is_marked(o)) {
+            bytes += obj_size(o);
+            p = &o->next;
+            continue;
+        }
+        *p = o->next;
+        m_gc.n      -= 1;
+        m_gc.nfreed += 1;
+        m_gc.bfreed += obj_size(o);
+        free_obj(o);
+    }
+    m_gc.bytes  = bytes + m_gc.sbytes;
+    m_gc.next   = m_gc.bytes * GC_HEAP_GROWTH;
+    if (m_gc.next < GC_HEAP_MIN)
+        m_gc.next = GC_HEAP_MIN;
+}
+
+// Perform a full collection. `mark_roots` is responsible for marking
+// every object directly reachable by the caller (see vm.c).
+void m_collect(void (*mark_roots)(void *), void *ud) {
+    clock_t start = clock();
+    mark_roots(ud);
+    sweep();
+    m_gc.epoch  = m_gc.epoch == 1 ? 2 : 1;
+    m_gc.ncoll += 1;
+    m_gc.secs  += (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Print collection statistics to stderr (riff -s)
+void m_stats(void) {
+    if (m_gc.bytes > m_gc.peak)
+        m_gc.peak = m_gc.bytes;
+    fprintf(stderr,
+            "riff: [gc] collections:   %zu\n"
+            "riff: [gc] objects freed: %zu (%zu bytes)\n"
+            "riff: [gc] live objects:  %zu (%zu bytes)\n"
+            "riff: [gc] peak heap:     %zu bytes\n"
+            "riff: [gc] time:          %.3f ms\n",
+            m_gc.ncoll,
+            m_gc.nfreed, m_gc.bfreed,
+            m_gc.n, m_gc.bytes,
+            m_gc.peak,
+            m_gc.secs * 1000);
+}
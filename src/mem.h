@@ -3,6 +3,9 @@
 
 #include <stdlib.h>
 
+#include "hash.h"
+#include "types.h"
+
 // Doubles the size of a given array's allocation if already at
 // capacity
 #define m_growarray(a, n, cap, sz) \
@@ -19,6 +22,40 @@
         b = realloc(b, sizeof(sz) * cap); \
     }
 
-#define m_freestr(s) free(s->str); free(s);
+// Garbage collector state
+typedef struct {
+    int      on;        // Track newly-allocated objects?
+    uint8_t  epoch;     // Mark value for the current collection
+    rf_obj  *objs;      // List of all tracked objects
+    size_t   n;         // Number of tracked objects
+    size_t   bytes;     // Bytes currently held by tracked objects
+    size_t   sbytes;    // Bytes held by shared string buffers (see str.c)
+    size_t   next;      // Heap size which triggers the next collection
+    size_t   ncoll;     // Number of collections performed
+    size_t   nfreed;    // Total number of objects freed
+    size_t   bfreed;    // Total number of bytes freed
+    size_t   peak;      // Largest heap size observed at a collection
+    double   secs;      // Total time spent collecting
+} rf_gc;
+
+extern rf_gc m_gc;
+
+// Has the heap grown enough to warrant a collection?
+#define m_gcdue() (m_gc.bytes >= m_gc.next)
+
+// Count `n` more bytes allocated on behalf of an object after it was
+// created, e.g. when a table's array part grows. The sweep recounts
+// the heap from the surviving objects, so this only needs to be
+// accurate until the next collection.
+#define m_grew(n) if (m_gc.on) m_gc.bytes += (n)
+
+void m_init(void);
+void m_track(rf_obj *, int);
+void m_markval(rf_val *);
+void m_markstr(rf_str *);
+void m_marktbl(rf_tbl *);
+void m_markhtbl(rf_htbl *);
+void m_collect(void (*)(void *), void *);
+void m_stats(void);
 
 #endif
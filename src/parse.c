@@ -137,7 +137,7 @@ static int resolve_local(rf_parser *y, rf_str *s) {
     i -= !!y->fx;
 
     for (; i >= 0; --i) {
-        if (y->lcl[i].id->hash == s->hash &&
+        if (s_eq(y->lcl[i].id, s) &&
             y->lcl[i].d <= y->ld)
             return i;
     }
@@ -513,8 +513,9 @@ static int led(rf_parser *y, int p, int tk) {
     return p;
 }
 
-static int expr(rf_parser *y, int rbp) {
-    int p  = nud(y);
+// Parse any infix/postfix operations binding tighter than `rbp`
+// following the already-parsed operand `p`
+static int leds(rf_parser *y, int p, int rbp) {
     int tk = y->x->tk.kind;
 
     while (rbp < lbp(tk)) {
@@ -544,6 +545,10 @@ static int expr(rf_parser *y, int rbp) {
     return p;
 }
 
+static int expr(rf_parser *y, int rbp) {
+    return leds(y, nud(y), rbp);
+}
+
 // Standalone expressions
 static void expr_stmt(rf_parser *y) {
     int n = expr_list(y, 0);
@@ -723,7 +728,8 @@ static void local_fn(rf_parser *y) {
     int idx = resolve_local(y, id);
 
     // Create string for disassembly
-    rf_str *fn_name = s_newstr_concat("local fn ", y->x->tk.lexeme.s->str, 0);
+    rf_str *fn_name = s_newstr_concat("local fn ", 9, y->x->tk.lexeme.s->str,
+                                      y->x->tk.lexeme.s->l, 0);
 
     // If the identifier doesn't already exist as a local at the
     // current scope, add a new local
@@ -793,6 +799,49 @@ static void fn_stmt(rf_parser *y) {
     f->arity = compile_fn(&fy);
 }
 
+// Parse the expression `z` in `for x in z`. If `z` is a sequence
+// literal (`x..y:z`, any part omitted), its bounds and interval are
+// pushed directly and the loop is compiled as a counted loop, which
+// allocates neither a sequence nor an iterator. Returns the type of
+// loop to compile (see enum iters).
+static int for_iterable(rf_parser *y, int kv) {
+    if (kv) {
+        expr(y, 0);
+        return ITER_KV;
+    }
+    if (y->x->tk.kind == TK_DOTS) {
+        push(OP_IMM0);
+    } else {
+        int p = expr(y, lbp(TK_DOTS));
+        if (y->x->tk.kind != TK_DOTS) {
+            leds(y, p, 0);
+            return ITER_V;
+        }
+    }
+    unset(rx);
+    if (!y->sd)
+        set(ox);
+    adv();
+
+    // Upper bound (see sequence())
+    if (y->x->tk.kind == ':' ||
+        y->x->tk.kind == ')' ||
+        y->x->tk.kind == '}' ||
+        y->x->tk.kind == ']')
+        c_constant(y->c, &(rf_token) {TK_INT, .lexeme.i = INT64_MAX});
+    else
+        expr(y, 0);
+
+    // Interval; zero lets the VM infer the direction
+    if (y->x->tk.kind == ':') {
+        adv();
+        expr(y, 0);
+    } else {
+        push(OP_IMM0);
+    }
+    return ITER_N;
+}
+
 static void for_stmt(rf_parser *y) {
     int paren = 0;
     if (y->x->tk.kind == '(') {
@@ -824,10 +873,19 @@ static void for_stmt(rf_parser *y) {
     }
     set(lx);
     consume(y, TK_IN, "expected 'in'");
-    expr(y, 0);
+    int type = for_iterable(y, kv);
     unset(fx);
     unset(lx);
-    int l1 = c_prep_loop(y->c, kv);
+    int l1 = c_prep_loop(y->c, type);
+
+    // Counted loops keep their iteration count and interval in two
+    // anonymous locals following the loop variable and never need
+    // OP_POPL
+    if (type == ITER_N) {
+        add_local(y, &(rf_str) {.l = 5, .str = "(for)"});
+        add_local(y, &(rf_str) {.l = 5, .str = "(for)"});
+        y->id--;
+    }
     if (paren)
         consume(y, ')', "expected ')'");
     uint8_t old_loop = y->loop;
@@ -854,7 +912,7 @@ static void for_stmt(rf_parser *y) {
     y->nlcl -= pop_locals(y, y->ld, 1);
 
     c_patch(y->c, l1);
-    c_loop(y->c, l1 + 2);
+    c_loop(y->c, type, l1 + 2);
 
     // Patch break stmts
     for (int i = 0; i < b.n; i++) {
@@ -864,10 +922,12 @@ static void for_stmt(rf_parser *y) {
     // OP_POPL cleans up iterator state in the VM. Needs to be its own
     // instruction since break statements need to jump past the
     // OP_LOOP instructions to prevent further iteration
-    push(OP_POPL);
+    if (type != ITER_N) {
+        push(OP_POPL);
+        y->id -= 1;
+    }
 
     y->ld -= 1;
-    y->id -= 1;
     y->loop = old_loop;
 
     // Pop locals with lexical depth as the argument instead of
@@ -1133,5 +1193,8 @@ int y_compile(rf_env *e) {
     pop_locals(&y, y.ld, 1);
     c_push(y.c, OP_RET);
     x_free(&x);
+    c_peephole(e->main.code);
+    for (int i = 0; i < e->nf; ++i)
+        c_peephole(e->fn[i]->code);
     return 0;
 }
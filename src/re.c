@@ -13,7 +13,7 @@ void re_register_fldv(rf_tbl *t) {
     return;
 }
 
-rf_re *re_compile(char *pattern, uint32_t flags, int *errcode) {
+rf_re *re_compile(char *pattern, size_t len, uint32_t flags, int *errcode) {
     if (context == NULL) {
         context = pcre2_compile_context_create(NULL);
         pcre2_set_compile_extra_options(context, RE_CFLAGS_EXTRA);
@@ -22,7 +22,7 @@ rf_re *re_compile(char *pattern, uint32_t flags, int *errcode) {
     PCRE2_SIZE erroffset;
     rf_re *r = pcre2_compile(
             (PCRE2_SPTR) pattern,   // Raw pattern string
-            PCRE2_ZERO_TERMINATED,  // Length (or specify zero terminated)
+            len,                    // Length
             flags | RE_CFLAGS,      // Options/flags
             errcode,                // Error code
             &erroffset,             // Error offset
@@ -41,8 +41,8 @@ int re_store_numbered_captures(pcre2_match_data *md) {
         PCRE2_UCHAR *buf;
         PCRE2_SIZE   l;
         if (!pcre2_substring_get_bynumber(md, i, &buf, &l)) {
-            rf_val v = (rf_val) {TYPE_STR, .u.s = s_newstr((const char *) buf, l, 0)};
-            t_insert_int(fldv, (rf_int) i, &v, 1, 0);
+            rf_val v = v_str(s_newstr((const char *) buf, l, 0));
+            t_insert_int(fldv, (rf_int) i, &v, 0);
         } else {
             break;
         }
@@ -51,7 +51,7 @@ int re_store_numbered_captures(pcre2_match_data *md) {
     return 0;
 }
 
-rf_int re_match(char *s, rf_re *re, int capture) {
+rf_int re_match(char *s, size_t len, rf_re *re, int capture) {
 
     // Create PCRE2 match data block
     pcre2_match_data *md = pcre2_match_data_create_from_pattern(re, NULL);
@@ -60,7 +60,7 @@ rf_int re_match(char *s, rf_re *re, int capture) {
     int rc = pcre2_match(
             re,                     // Compiled regex
             (PCRE2_SPTR) s,         // String to match against
-            PCRE2_ZERO_TERMINATED,  // Length (or specify zero terminated)
+            len,                    // Length
             0,                      // Start offset
             0,                      // Options/flags
             md,                     // Match data block
@@ -2,10 +2,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "code.h"
 #include "disas.h"
 #include "env.h"
+#include "mem.h"
 #include "parse.h"
 #include "types.h"
 #include "util.h"
@@ -17,6 +19,7 @@ int wasm_main(int flag, char *str) {
     rf_env e;
     rf_fn  main;
     rf_code c;
+    u_seedhash((uint64_t) time(0));
     c_init(&c);
     main.code  = &c;
     main.arity = 0;
@@ -50,6 +53,7 @@ static void usage(void) {
          "  -f file  execute program stored in 'file'\n"
          "  -h       print this usage text and exit\n"
          "  -l       list bytecode with assembler-like mnemonics\n"
+         "  -s       print garbage collector statistics on exit\n"
          "  -v       print version information and exit\n"
          "  --       stop processing options");
     exit(0);
@@ -65,6 +69,9 @@ int main(int argc, char **argv) {
     rf_env e;
     rf_fn  main;
     rf_code c;
+    // Address space layout randomization makes the stack address a
+    // second source of entropy
+    u_seedhash((uint64_t) time(0) ^ (uintptr_t) &e);
     c_init(&c);
     main.code  = &c;
     main.arity = 0;
@@ -79,7 +86,7 @@ int main(int argc, char **argv) {
     opterr = 0;
 
     int o;
-    while ((o = getopt(argc, argv, "f:hlv")) != -1) {
+    while ((o = getopt(argc, argv, "f:hlsv")) != -1) {
         switch (o) {
         case 'f':
             ff = 1;
@@ -91,6 +98,9 @@ int main(int argc, char **argv) {
         case 'l':
             lf = 1;
             break;
+        case 's':
+            atexit(m_stats);
+            break;
         case 'v':
             version();
         case '?':
@@ -4,41 +4,158 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "conf.h"
+#include "hash.h"
+#include "mem.h"
 #include "types.h"
 #include "util.h"
 
-rf_str *s_newstr(const char *start, size_t l, int h) {
-    char *str = malloc(l * sizeof(char) + 1);
-    memcpy(str, start, l);
-    str[l] = '\0';
-    rf_str *s = malloc(sizeof(rf_str));
+// Allocate a string of length `l`, with its bytes to be filled in by
+// the caller, and register it with the garbage collector
+rf_str *s_alloc(size_t l) {
+    rf_str *s = malloc(sizeof(rf_str) + l + 1);
     s->l = l;
-    s->hash = h ? u_strhash(str) : 0;
-    s->str = str;
+    s->hash = 0;
+    s->interned = 0;
+    s->cat = 0;
+    s->shared = 0;
+    s->str = s->buf;
+    s->str[l] = '\0';
+    m_track(&s->o, TYPE_STR);
+    return s;
+}
+
+rf_str *s_newstr(const char *start, size_t l, int h) {
+    rf_str *s = s_alloc(l);
+    memcpy(s->str, start, l);
+    if (h)
+        s->hash = u_strhash(s->str, l);
+    return s;
+}
+
+// Compare strings `a` and `b` byte for byte. Hashes are only used to
+// rule out a match early when both have already been computed.
+int s_eq(rf_str *a, rf_str *b) {
+    if (a == b)
+        return 1;
+    if (a->interned && b->interned)
+        return 0;
+    if (a->l != b->l || (a->hash && b->hash && a->hash != b->hash))
+        return 0;
+    return !memcmp(a->str, b->str, a->l);
+}
+
+rf_str *s_newstr_concat(const char *l, size_t l_len,
+                        const char *r, size_t r_len, int h) {
+    rf_str *s = s_alloc(l_len + r_len);
+    memcpy(s->str, l, l_len);
+    memcpy(s->str + l_len, r, r_len);
+    if (h)
+        s->hash = u_strhash(s->str, s->l);
     return s;
 }
 
-// Assumes null-terminated strings
-rf_str *s_newstr_concat(char *l, char *r, int h) {
-    size_t l_len = strlen(l);
-    size_t r_len = strlen(r);
-    size_t new_len = l_len + r_len;
-    char *new = malloc(new_len * sizeof(char) + 1);
-    memcpy(new, l, l_len);
-    memcpy(new + l_len, r, r_len);
-    new[new_len] = '\0';
-    rf_str *s = malloc(sizeof(rf_str));
-    s->l = new_len;
-    s->hash = h ? u_strhash(new) : 0;
-    s->str = new;
+// Buffer shared by strings built by repeated concatenation. Each
+// string holds a prefix of the buffer; the longest one is the only
+// one whose terminator is intact, and the only one which can be
+// appended to in place.
+typedef struct {
+    size_t n;       // Number of strings sharing the buffer
+    size_t used;    // Length of the longest string
+    size_t cap;     // Capacity, excluding the terminator
+    char   buf[];
+} rf_strbuf;
+
+// A string in a shared buffer holds a pointer to the buffer in place
+// of its own bytes
+#define strbuf(s) (*(rf_strbuf **) (s)->buf)
+
+// Buffers aren't objects of their own, so the collector keeps a
+// separate count of the bytes they hold (m_gc.sbytes)
+#define buf_size(b) (sizeof(rf_strbuf) + (b)->cap + 1)
+
+// Create a string of the first `l` bytes of buffer `b`
+static rf_str *share(rf_strbuf *b, size_t l) {
+    rf_str *s = malloc(sizeof(rf_str) + sizeof(rf_strbuf *));
+    s->l = l;
+    s->hash = 0;
+    s->interned = 0;
+    s->cat = 1;
+    s->shared = 1;
+    s->str = b->buf;
+    strbuf(s) = b;
+    b->n++;
+    m_track(&s->o, TYPE_STR);
     return s;
 }
 
-rf_str *s_substr(char *s, rf_int from, rf_int to, rf_int itvl) {
-    // Correct out-of-bounds ranges
-    size_t sl = strlen(s);
-    from = from > sl ? sl : from < 0 ? 0 : from;
-    to   = to   > sl ? sl : to   < 0 ? 0 : to;
+static void unshare(rf_str *s) {
+    rf_strbuf *b = strbuf(s);
+    if (!--b->n) {
+        m_gc.sbytes -= buf_size(b);
+        free(b);
+    }
+    s->shared = 0;
+}
+
+// Give a string in a shared buffer its own copy of its bytes (see
+// s_use())
+void s_own(rf_str *s) {
+    char *str = malloc(s->l + 1);
+    memcpy(str, s->str, s->l);
+    str[s->l] = '\0';
+    unshare(s);
+    s->str = str;
+    m_grew(s->l + 1);
+}
+
+// Concatenate string `s` and the `rl` bytes at `r`.
+//
+// Concatenating onto the result of a concatenation, as `s #= x` in a
+// loop does, would copy the whole string every time. Instead, once
+// the result is at least STR_APPEND_MIN bytes, it's put in a buffer
+// twice its size, and concatenating onto the longest string in the
+// buffer appends to the buffer in place. Building a string this way
+// takes linear time. The strings sharing the buffer are unchanged,
+// except that all but the longest lose their terminator (see
+// s_use()).
+rf_str *s_append(rf_str *s, const char *r, size_t rl) {
+    size_t     l = s->l + rl;
+    rf_strbuf *b = s->shared ? strbuf(s) : NULL;
+    if (b && s->l == b->used && l <= b->cap) {
+        memcpy(b->buf + s->l, r, rl);
+        b->buf[l] = '\0';
+        b->used = l;
+        return share(b, l);
+    }
+    if (!s->cat || l < STR_APPEND_MIN) {
+        rf_str *x = s_alloc(l);
+        memcpy(x->str, s->str, s->l);
+        memcpy(x->str + s->l, r, rl);
+        x->cat = 1;
+        return x;
+    }
+    b = malloc(sizeof(rf_strbuf) + 2 * l + 1);
+    b->n    = 0;
+    b->used = l;
+    b->cap  = 2 * l;
+    m_gc.sbytes += buf_size(b);
+    m_grew(buf_size(b));
+    memcpy(b->buf, s->str, s->l);
+    memcpy(b->buf + s->l, r, rl);
+    b->buf[l] = '\0';
+    return share(b, l);
+}
+
+rf_str *s_substr(const char *s, size_t sl, rf_int from, rf_int to,
+                 rf_int itvl) {
+    // Correct out-of-bounds ranges. Strings may hold null bytes, so
+    // the terminator mustn't be included.
+    if (!sl)
+        return s_alloc(0);
+    rf_int last = (rf_int) sl - 1;
+    from = from > last ? last : from < 0 ? 0 : from;
+    to   = to   > last ? last : to   < 0 ? 0 : to;
 
     size_t len;
     if (itvl > 0)
@@ -53,17 +170,12 @@ rf_str *s_substr(char *s, rf_int from, rf_int to, rf_int itvl) {
         itvl = -itvl;
 
     len = (size_t) ceil(fabs(len / (double) itvl));
-    char *str = malloc(len * sizeof(char) + 1);
-    for (size_t i = 0; i <= len; ++i) {
-        str[i] = s[from];
+    rf_str *str = s_alloc(len);
+    for (size_t i = 0; i < len; ++i) {
+        str->str[i] = s[from];
         from += itvl;
     }
-    str[len] = '\0';
-    rf_str *ns = malloc(sizeof(rf_str));
-    ns->str = str;
-    ns->l = len;
-    ns->hash = 0;
-    return ns;
+    return str;
 }
 
 rf_str *s_int2str(rf_int i) {
@@ -77,3 +189,52 @@ rf_str *s_flt2str(rf_flt f) {
     size_t len = sprintf(str, "%g", f);
     return s_newstr(str, len, 0);
 }
+
+// Interned strings
+//
+// Short strings used as table keys, constants or identifiers are
+// interned, so equal ones share a single rf_str. Two interned strings
+// are equal only if they're the same string. The set holds its
+// strings weakly: the collector frees an interned string no longer
+// referenced anywhere else, which removes it from the set.
+static rf_htbl strtab;
+
+// Return the interned string equal to `s`. If there isn't one, `s`
+// (which must not be freed by anything but the collector) becomes it.
+// Strings longer than STR_INTERN_MAX are returned as is.
+rf_str *s_intern(rf_str *s) {
+    if (s->interned || s->l > STR_INTERN_MAX)
+        return s;
+    rf_val  k = v_str(s);
+    rf_val *v = h_get(&strtab, &k);
+    if (v)
+        return as_str(v);
+    s->interned = 1;
+    h_insert(&strtab, &k, &k);
+    return s;
+}
+
+// Return the interned string holding the `l` bytes at `str`, only
+// creating a new string if there isn't one
+rf_str *s_internstr(const char *str, size_t l) {
+    if (l <= STR_INTERN_MAX) {
+        rf_str  s = (rf_str) {.l = l, .str = (char *) str};
+        rf_val  k = v_str(&s);
+        rf_val *v = h_get(&strtab, &k);
+        if (v)
+            return as_str(v);
+    }
+    return s_intern(s_newstr(str, l, 1));
+}
+
+void s_free(rf_str *s) {
+    if (s->interned) {
+        rf_val k = v_str(s);
+        h_delete(&strtab, &k);
+    }
+    if (s->shared)
+        unshare(s);
+    else if (s->str != s->buf)
+        free(s->str);
+    free(s);
+}
@@ -1,5 +1,5 @@
-#include <ctype.h>
-#include <stdio.h>
+#include <math.h>
+#include <string.h>
 
 #include "table.h"
 #include "mem.h"
@@ -7,13 +7,12 @@
 #define set(f)   t->f = 1
 #define unset(f) t->f = 0
 
-#define MIN_LOAD_FACTOR 0.5
+void (*t_moved)(uintptr_t, rf_val *, size_t);
 
 void t_init(rf_tbl *t) {
     unset(nullx);
     unset(lx);
     t->n     = 0;
-    t->an    = 0;
     t->cap   = 0;
     t->nullv = v_newnull();
     t->v     = NULL;
@@ -21,236 +20,385 @@ void t_init(rf_tbl *t) {
     h_init(t->h);
 }
 
-// lx flag is set whenever the VM performs a lookup with the intent on
-// setting the value (OP_xxA). When lx is set, recalculate length of
-// the array. This accomodates "deletion" via `null` assignment.
+rf_tbl *t_newtbl(void) {
+    rf_tbl *t = malloc(sizeof(rf_tbl));
+    t_init(t);
+    m_track(&t->o, TYPE_TBL);
+    return t;
+}
+
+// Free a table and its slots. Strings and tables referenced by the
+// table's values are owned by the garbage collector.
+void t_free(rf_tbl *t) {
+    free(t->v);
+    free(t->nullv);
+    h_free(t->h);
+    free(t->h);
+    free(t);
+}
+
+// Element counts are kept current as the table is written to, so this
+// is O(1) unless t_recount() was called since the last length query
+// (see below).
 rf_int t_length(rf_tbl *t) {
-    if (!t->lx)
-        return t->n + h_length(t->h);
-    rf_int l = 0;
-    for (int i = 0; i < t->cap; ++i) {
-        if (t->v[i] && !is_null(t->v[i]))
-            ++l;
-    }
     // Include special "null" index
-    l += (t->nullx && !is_null(t->nullv));
-    t->n = l;
-    unset(lx);
-    return l + h_length(t->h);
+    rf_int l = t->nullx && !is_null(t->nullv);
+    if (t->lx) {
+        t->n = 0;
+        for (int i = 0; i < t->cap; ++i)
+            t->n += !is_null(&t->v[i]);
+        unset(lx);
+    }
+    return l + t->n + h_length(t->h);
+}
+
+// Slots handed out by t_lookup() with the intent to set them are
+// written to by the VM, not the table. The VM reports each such write
+// with t_wrote(), passing whether the slot was null when handed out,
+// so the table can account for an element being added or deleted.
+void t_wrote(rf_tbl *t, rf_val *p, int wasnull) {
+    int d = !is_null(p) - !wasnull;
+    if (!d)
+        return;
+    if (p >= t->v && p < t->v + t->cap)
+        t->n += d;
+    else if (p != t->nullv)
+        t->h->n += d;
 }
 
-static int exists(rf_tbl *t, rf_int k) {
-    return k >= 0 && k < t->cap && t->v[k] != NULL;
+// Writes the VM can't account for make the next t_length() count the
+// table's elements from scratch
+void t_recount(rf_tbl *t) {
+    set(lx);
+    t->h->lx = 1;
 }
 
-rf_val *t_collect_keys(rf_tbl *t) {
-    rf_int len = t_length(t);
-    rf_val *keys = malloc(len * sizeof(rf_val));
-    int n = 0;
-    for (rf_int i = 0; i < t->cap && n <= len; ++i) {
-        if (exists(t, i) && !is_null(t->v[i])) {
-            keys[n++] = (rf_val) {TYPE_INT, .u.i = i};
+// Is int k within the array part?
+static int in_array(rf_tbl *t, rf_int k) {
+    return k >= 0 && k < t->cap;
+}
+
+enum parts {
+    PART_ARRAY,
+    PART_HASH,
+    PART_NULL,
+    PART_END
+};
+
+void t_cursor(rf_tbl *t, rf_cursor *c) {
+    c->part = PART_ARRAY;
+    c->i    = 0;
+    c->acap = t->cap;
+    c->hcap = t->h->cap;
+}
+
+// Advance cursor `c` to the next entry of the table with a non-null
+// value, storing its key in `k` and a pointer to its value in `v`.
+// Returns 0 once the traversal is complete.
+//
+// Entries are visited in storage order: the array part, the hash
+// part, then the "null" index. Traversal reads the table's slots
+// directly, so it allocates nothing and hashes nothing.
+//
+// Mutating the table during traversal:
+//   - Assigning to keys already in the table (including clearing them
+//     with null) is safe. Every other entry is still visited exactly
+//     once, and cleared entries not yet reached are skipped.
+//   - Entries inserted for new keys may or may not be visited. If an
+//     insertion grows the table, entries may be visited more than
+//     once or skipped.
+// Traversal never visits more slots than the table had when the
+// cursor was initialized, so it always terminates.
+int t_next(rf_tbl *t, rf_cursor *c, rf_val *k, rf_val **v) {
+    switch (c->part) {
+    case PART_ARRAY:
+        for (; c->i < c->acap; ++c->i) {
+            if (in_array(t, c->i) && !is_null(&t->v[c->i])) {
+                *k = v_int(c->i);
+                *v = &t->v[c->i++];
+                return 1;
+            }
+        }
+        c->part = PART_HASH;
+        c->i    = 0;
+        // Fall-through
+    case PART_HASH: {
+        rf_htbl *h = t->h;
+        for (; c->i < c->hcap; ++c->i) {
+            if (c->i < h->cap && h_full(h, c->i) &&
+                !is_null(&h->e[c->i].val)) {
+                *k = h->e[c->i].key;
+                *v = &h->e[c->i++].val;
+                return 1;
+            }
         }
+        c->part = PART_NULL;
     }
-    rf_htbl *h = t->h;
-    for (int i = 0; i < h->cap && n <= len; ++i) {
-        if (h->nodes[i] && !is_null(h->nodes[i]->val)) {
-            keys[n++] = (rf_val) {TYPE_STR, .u.s = h->nodes[i]->key};
+        // Fall-through
+    case PART_NULL:
+        c->part = PART_END;
+        if (t->nullx && !is_null(t->nullv)) {
+            *k = v_null;
+            *v = t->nullv;
+            return 1;
         }
+        // Fall-through
+    default:
+        return 0;
     }
-    if (t->nullx)
-        keys[n++] = (rf_val) {TYPE_NULL, .u.i = 0};
-    return keys;
 }
 
-static double potential_lf(int n, int cap, rf_int k) {
-    double n1 = n + 1.0;
-    double n2 = cap > k ? cap : k + 1.0;
-    return n1 / n2;
+// Move value `hv`, just removed from the hash part, to index `i` of
+// the array part
+static void migrate(rf_tbl *t, rf_int i, rf_val *hv) {
+    t->v[i] = *hv;
+    t->n += !is_null(hv);
+    if (t_moved)
+        t_moved((uintptr_t) hv, &t->v[i], 1);
 }
 
-// Source: The Implementation of Lua 5.0, section 4
-// The computed size of the array part is the largest n such that at
-// least half the slots between 1 and n are in use (to avoid wasting
-// space with sparse arrays) and there is at least one used slot
-// between n/2 + 1 and n (to avoid a size n when n/2 would do)
+// Grow the array part to `nc` slots, moving any int keys from the
+// hash part which now fall within it
+static void grow_array(rf_tbl *t, int nc) {
+    int oc = t->cap;
+    uintptr_t ov = (uintptr_t) t->v;
+    t->v = realloc(t->v, sizeof(rf_val) * nc);
+    if ((uintptr_t) t->v != ov && oc && t_moved)
+        t_moved(ov, t->v, oc);
+    m_grew(sizeof(rf_val) * (nc - oc));
 
-// If int k is within the capacity of the "array" part, perform the
-// lookup. Otherwise, defer to h_lookup().
-static rf_val *t_lookup_int(rf_tbl *t, rf_int k, int set) {
-    if (set) set(lx);
-    if (exists(t, k)) {
-        return t->v[k];
-    }
-    if (!t->cap) {
-        return t_insert_int(t, k, v_newnull(), set, 0);
-    }
-    if (k >= 0 && (k < t->cap ||
-        (potential_lf(t->an, t->cap, k) >= MIN_LOAD_FACTOR))) {
-        return t_insert_int(t, k, v_newnull(), set, 0);
+    for (int i = oc; i < nc; ++i)
+        t->v[i] = v_null;
+    t->cap = nc;
+
+    // Either look up each new index or scan the hash part, whichever
+    // visits fewer slots
+    rf_htbl *h = t->h;
+    if (!h->an)
+        return;
+    if ((uint32_t) (nc - oc) < h->cap) {
+        for (int i = oc; i < nc; ++i) {
+            rf_val  k  = v_int(i);
+            rf_val *hv = h_delete(h, &k);
+            if (hv)
+                migrate(t, i, hv);
+        }
     } else {
-        rf_str *ik = s_int2str(k);
-        rf_val *v  = h_lookup(t->h, ik, set);
-        m_freestr(ik);
-        return v;
+        for (uint32_t i = 0; i < h->cap; ++i) {
+            rf_val *k = &h->e[i].key;
+            if (h_full(h, i) && is_int(k) && as_int(k) >= oc &&
+                as_int(k) < nc) {
+                h_remove(h, i);
+                migrate(t, as_int(k), &h->e[i].val);
+            }
+        }
     }
 }
 
-// If the entire string is a valid integer, return the number
-static rf_int str2intidx(rf_str *s) {
-    char *end;
-    rf_flt f = u_str2d(s->str, &end, 0);
-    rf_int i = (rf_int) f;
-    if (f == i && *end == '\0') {
-        // Be dubious of strings coerced to 0.0; make sure the string
-        // actually has `0` in it somewhere. Otherwise, it may read
-        // a string like "+" to be 0.0, which would be unintended.
-        if (f == 0.0) {
-            for (int j = 0; j < s->l; ++j) {
-                if (s->str[j] == '0')
-                    return 0;
-            }
-            return -1;
-        }
-        return i;
+// Int keys are counted in bins by magnitude when sizing the array
+// part. Bin 0 holds key 0 and bin b > 0 holds keys in
+// [2^(b-1), 2^b), i.e. the keys an array part of 2^b slots holds which
+// one of 2^(b-1) slots doesn't. Keys of 2^MAXBITS and up always go in
+// the hash part.
+#define MAXBITS 30
+
+static int bin(rf_int k) {
+    int b = 0;
+    while (k >> b)
+        ++b;
+    return b;
+}
+
+// Count the non-null values in the array part into `nums`. Returns
+// the total.
+static int count_array(rf_tbl *t, int *nums) {
+    int total = 0;
+    for (int b = 0, i = 0; b <= MAXBITS && i < t->cap; ++b) {
+        int lim = b ? 1 << b : 1;
+        if (lim > t->cap)
+            lim = t->cap;
+        for (; i < lim; ++i)
+            nums[b] += !is_null(&t->v[i]);
+        total += nums[b];
     }
-    return -1;
+    return total;
 }
 
-// TODO flt lookup is slow with string conversion
-rf_val *t_lookup(rf_tbl *t, rf_val *k, int set) {
-    if (set) set(lx);
-    switch (k->type) {
-    case TYPE_NULL:
-        if (set && !t->nullx) {
-            set(nullx);
-            t->n++;
+// Count the non-negative int keys in the hash part into `nums`.
+// Returns the total.
+static int count_hash(rf_htbl *h, int *nums) {
+    int total = 0;
+    for (uint32_t i = 0; i < h->cap; ++i) {
+        rf_val *k = &h->e[i].key;
+        if (h_full(h, i) && is_int(k) && as_int(k) >= 0 &&
+            as_int(k) < ((rf_int) 1 << MAXBITS)) {
+            nums[bin(as_int(k))]++;
+            total++;
         }
-        return t->nullv;
-    case TYPE_INT:
-        if (k->u.i < 0) {
-            rf_str *ik = s_int2str(k->u.i);
-            rf_val *v  = h_lookup(t->h, ik, set);
-            m_freestr(ik);
-            return v;
-        }
-        else
-            return t_lookup_int(t, k->u.i, set);
-    case TYPE_FLT:
-        if ((k->u.f == (rf_int) k->u.f) &&
-            ((rf_int) k->u.f >= 0))
-            return t_lookup_int(t, (rf_int) k->u.f, set);
-        else {
-            rf_str *fk = s_flt2str(k->u.f);
-            rf_val *v  = h_lookup(t->h, fk, set);
-            m_freestr(fk);
-            return v;
-        }
-    case TYPE_STR: {
-        rf_int si = str2intidx(k->u.s);
-        return si >= 0 ? t_lookup_int(t, si, set)
-                       : h_lookup(t->h, k->u.s, set);
+    }
+    return total;
+}
 
+// Source: The Implementation of Lua 5.0, section 4
+// The computed size of the array part is the largest n, a power of 2,
+// such that more than half the slots between 0 and n-1 would be in
+// use, given `na` int keys counted into `nums`
+static int compute_size(int *nums, int na) {
+    int a  = 0;
+    int sz = 0;
+    for (int b = 0, n = 1; b <= MAXBITS && na > n / 2; ++b, n *= 2) {
+        a += nums[b];
+        if (a > n / 2)
+            sz = n;
     }
-    // TODO monitor
-    case TYPE_TBL: {
-        rf_str *tk = s_int2str((rf_int) k->u.t);
-        rf_val *v  = h_lookup(t->h, s_int2str((rf_int) k->u.t), set);
-        m_freestr(tk);
-        return v;
+    return sz;
+}
+
+// Called when a new key `k` doesn't fit in the hash part. Counts
+// every int key in the table, including `k`, and grows the array part
+// to the size compute_size() picks. This is the only place the array
+// part grows on its own, so it doubles at most once per resize of the
+// hash part, and int keys are only ever counted then.
+//
+// Keys inserted in descending order (e.g. `for i in n..0 t[i] = x`)
+// only fill more than half of the slots below them once most of them
+// are inserted, so most of them go in the hash part first and are
+// migrated when it's next resized. Such a fill is several times slower
+// than an ascending one, though it still ends up in the array part.
+static void rehash(rf_tbl *t, rf_val *k) {
+    int nums[MAXBITS + 1] = {0};
+    int na = count_array(t, nums) + count_hash(t->h, nums);
+    if (is_int(k) && as_int(k) >= 0 &&
+        as_int(k) < ((rf_int) 1 << MAXBITS)) {
+        nums[bin(as_int(k))]++;
+        na++;
     }
-    case TYPE_RFN: // TODO
-    default: break;
+    int sz = compute_size(nums, na);
+    if (sz > t->cap)
+        grow_array(t, sz);
+}
+
+// Return the slot for key `k`, which isn't an index into the array
+// part, creating it if needed. A new key the hash part has no room
+// for triggers a rehash first, after which `k` may belong in the
+// array part. New string keys are interned, so tables with the same
+// keys share them.
+static rf_val *new_slot(rf_tbl *t, rf_val *k) {
+    rf_val *p = h_get(t->h, k);
+    if (p)
+        return p;
+    rf_val ik;
+    if (is_str(k)) {
+        ik = v_str(s_intern(as_str(k)));
+        k  = &ik;
     }
-    return NULL;
+    if (h_crowded(t->h)) {
+        rehash(t, k);
+        if (is_int(k) && in_array(t, as_int(k)))
+            return &t->v[as_int(k)];
+    }
+    return h_insert(t->h, k, &v_null);
 }
 
-static int new_size(int n, int cap, rf_int k) {
-    int sz = cap < k ? k + 1 : cap + 1;
-    while (potential_lf(n, sz, k) >= MIN_LOAD_FACTOR) {
-        ++sz;
+// If int k is within the capacity of the "array" part, perform the
+// lookup. Otherwise, defer to the hash part.
+static rf_val *t_lookup_int(rf_tbl *t, rf_int k, int set) {
+    if (in_array(t, k))
+        return &t->v[k];
+    // Appending just past the end of an array part with no more than
+    // one hole (e.g. `t[#t+1] = x` on a 1-based array) doubles it
+    // without counting keys, as at least half of it stays in use
+    if (set && !t->lx && k >= 0 && k <= t->cap + 1 &&
+        t->n + 1 >= t->cap) {
+        grow_array(t, t->cap ? 2 * t->cap : 2);
+        if (in_array(t, k))
+            return &t->v[k];
     }
-    return sz + 1;
+    rf_val key = v_int(k);
+    return set ? new_slot(t, &key) : h_lookup(t->h, &key, 0);
 }
 
-// VM currently initializes sequential tables backwards, inserting the
-// last element first by calling t_insert_int() with `force` set to 1.
-// This allows memory to be allocated once with the exact size needed
-// instead of potentially resizing multiple times throughout
-// initialization. Otherwise, t_insert_int() can defer to the hash
-// table part of the rf_tbl if the rf_int `k` would cause the array
-// part to be too sparsely populated.
-rf_val *t_insert_int(rf_tbl *t, rf_int k, rf_val *v, int set, int force) {
-    if (set) set(lx);
-    if (k >= 0 && (force || (potential_lf(t->an, t->cap, k) >= MIN_LOAD_FACTOR))) {
-        if (t->cap <= k || h_exists_int(t->h, k)) {
-            set(lx);
-            int oc = t->cap;
-            int nc = force ? k + 1 : new_size(t->an, t->cap, k);
-            // TODO the hackiest hack that ever hacked - maybe keep
-            // track of integer keys in the hash part instead
-            nc += !force * h_length(t->h);
-            t->v = realloc(t->v, sizeof(rf_val *) * nc);
+// If the entire string is a number, store it in `n` and return 1
+static int str2num(rf_str *s, rf_val *n) {
+    char *end;
+    rf_flt f = u_str2d(s->str, &end, 0);
+    if (end != s->str + s->l)
+        return 0;
+    // Be dubious of strings coerced to 0.0; make sure the string
+    // actually has `0` in it somewhere. Otherwise, it may read a
+    // string like "+" to be 0.0, which would be unintended.
+    if (f == 0.0 && !memchr(s->str, '0', s->l))
+        return 0;
+    *n = v_flt(f);
+    return 1;
+}
 
-            // Collect valid integer keys from the hash part and move
-            // them to the newly allocated array part
-            for (int i = oc; i < nc; ++i) {
-                if (exists(t,i)) continue;
-                rf_str *ik = s_int2str(i);
-                t->v[i] = h_delete(t->h, ik);
-                if (t->v[i]) t->an++;
-                m_freestr(ik);
-            }
-            t->cap = nc;
+// Numbers with an integral value are keyed as ints, and strings which
+// are entirely a number are keyed as that number. E.g. t[1], t[1.0]
+// and t["1"] are the same element. Returns `k` itself, or `n` holding
+// the key it normalizes to.
+//
+// Any other float is keyed on its exact bits. -0.0 is integral, so it
+// is the same key as 0. Every NaN is the same key, regardless of its
+// sign or payload, even though NaN never compares equal to itself.
+static rf_val *norm_key(rf_val *k, rf_val *n) {
+    if (is_str(k)) {
+        if (!str2num(as_str(k), n))
+            return k;
+        k = n;
+    }
+    if (is_flt(k)) {
+        rf_flt f = as_flt(k);
+        if (f >= (rf_flt) INT64_MIN && f < -(rf_flt) INT64_MIN &&
+            f == (rf_int) f) {
+            *n = v_int((rf_int) f);
+            return n;
         }
-        if (!exists(t, k)) {
-            rf_val *nv = malloc(sizeof(rf_val));
-            *nv     = *v;
-            t->v[k] = nv;
-            t->an++;
-            if (set && !is_null(v))
-                t->n++;
-        } else {
-            *t->v[k] = *v;
+        if (isnan(f)) {
+            *n = v_flt(NAN);
+            return n;
         }
-        return t->v[k];
-    }
-    else {
-        rf_str *ik = s_int2str(k);
-        rf_val *rv = h_lookup(t->h, ik, set); // TODO?
-        m_freestr(ik);
-        return rv;
     }
+    return k;
 }
 
-rf_val *t_insert(rf_tbl *t, rf_val *k, rf_val *v, int set) {
-    if (set) set(lx);
-    switch (k->type) {
+rf_val *t_lookup(rf_tbl *t, rf_val *k, int set) {
+    rf_val n;
+    k = norm_key(k, &n);
+    switch (type_of(k)) {
     case TYPE_NULL:
-        *t->nullv = *v;
-        if (!is_null(v)) t->n++;
+        if (set)
+            set(nullx);
         return t->nullv;
-    case TYPE_INT: return t_insert_int(t, k->u.i, v, set, 0);
-    case TYPE_FLT:
-        if (k->u.f == (rf_int) k->u.f)
-            return t_insert_int(t, (rf_int) k->u.f, v, set, 0);
-        else {
-            rf_str *fk = s_flt2str(k->u.f);
-            rf_val *rv = h_insert(t->h, fk, v, set);
-            m_freestr(fk);
-            return rv;
-        }
-    case TYPE_STR: return h_insert(t->h, k->u.s, v, set);
-
-    // TODO monitor
-    case TYPE_TBL: {
-        rf_str *tk = s_int2str((rf_int) k->u.t);
-        rf_val *rv = h_insert(t->h, tk, v, set);
-        m_freestr(tk);
-        return rv;
-    }
-    case TYPE_RFN: // TODO
-    default: break;
+    case TYPE_INT:
+        if (as_int(k) >= 0)
+            return t_lookup_int(t, as_int(k), set);
+        // Fall-through
+    default:
+        return set ? new_slot(t, k) : h_lookup(t->h, k, 0);
     }
-    return NULL;
+}
+
+// Write `v` to slot `p` of the table, keeping its counts current
+static rf_val *store(rf_tbl *t, rf_val *p, rf_val *v) {
+    int wasnull = is_null(p);
+    *p = *v;
+    t_wrote(t, p, wasnull);
+    return p;
+}
+
+// Inserting with `force` set to 1 puts int key `k` in the array part,
+// growing it to at least k+1 slots. The VM initializes sequential
+// tables backwards, inserting the last element first, so memory is
+// allocated once with the exact size needed. Library functions
+// building a table front to back instead double the array part as it
+// fills, so each element isn't a reallocation of its own.
+rf_val *t_insert_int(rf_tbl *t, rf_int k, rf_val *v, int force) {
+    if (force && k >= t->cap && k < ((rf_int) 1 << MAXBITS))
+        grow_array(t, k < 2 * t->cap ? 2 * t->cap : k + 1);
+    return store(t, t_lookup_int(t, k, 1), v);
+}
+
+rf_val *t_insert(rf_tbl *t, rf_val *k, rf_val *v) {
+    return store(t, t_lookup(t, k, 1), v);
 }
@@ -4,24 +4,52 @@
 #include "hash.h"
 #include "types.h"
 
+// Table traversal cursor (see t_next())
+typedef struct {
+    int      part;  // Part of the table being traversed
+    uint32_t i;     // Next slot to visit within the part
+    uint32_t acap;  // Capacity of the array part at the start
+    uint32_t hcap;  // Capacity of the hash part at the start
+} rf_cursor;
+
 struct rf_tbl {
-    int n;          // Number of elements (excluding null values)
-    int an;         // Number of elements (including null values)
-    int cap;
+    rf_obj o;       // GC header
+    int n;          // Number of non-null values in the array part
+    int cap;        // Size of the array part
 
     int nullx: 1;   // null flag ("null" index set?)
-    int lx:    1;   // Re-calculate length?
+    int lx:    1;   // Recount elements? (see t_recount())
 
     rf_val  *nullv; // Special slot for the "null" index in an array
-    rf_val **v;
+    rf_val  *v;     // Array part; unused slots are null
     rf_htbl *h;
 };
 
+// Called whenever values are moved to a new address: when the array
+// part is resized, when the hash part is rebuilt (see hash.c), or when
+// int keys are migrated from the hash part to the array part.
+// Arguments are the old address, the new address and the number of
+// values moved. The old address is passed as an integer, since the
+// memory it pointed to may already be freed.
+//
+// This is the one place the table module calls up into the VM. The
+// VM holds addresses of table slots on its stack between looking up
+// a slot and writing to it (see OP_IDXA), and any write in between,
+// e.g. `t[0] = (t[1] = 2)`, may move them. The VM registers a
+// function which patches up these addresses (move_slots() in vm.c).
+// Without one, e.g. while compiling, nothing holds such addresses.
+extern void (*t_moved)(uintptr_t, rf_val *, size_t);
+
 void    t_init(rf_tbl *);
+rf_tbl *t_newtbl(void);
+void    t_free(rf_tbl *);
 rf_int  t_length(rf_tbl *);
-rf_val *t_collect_keys(rf_tbl *);
+void    t_cursor(rf_tbl *, rf_cursor *);
+int     t_next(rf_tbl *, rf_cursor *, rf_val *, rf_val **);
 rf_val *t_lookup(rf_tbl *, rf_val *, int);
-rf_val *t_insert_int(rf_tbl *, rf_int, rf_val *, int, int);
-rf_val *t_insert(rf_tbl *, rf_val *, rf_val *, int);
+rf_val *t_insert_int(rf_tbl *, rf_int, rf_val *, int);
+rf_val *t_insert(rf_tbl *, rf_val *, rf_val *);
+void    t_wrote(rf_tbl *, rf_val *, int);
+void    t_recount(rf_tbl *);
 
 #endif
@@ -22,27 +22,52 @@ enum types {
     TYPE_CFN
 };
 
-#define is_null(x) (!(x)->type)
-#define is_int(x)  ((x)->type == TYPE_INT)
-#define is_flt(x)  ((x)->type == TYPE_FLT)
-#define is_str(x)  ((x)->type == TYPE_STR)
-#define is_re(x)   ((x)->type == TYPE_RE)
-#define is_seq(x)  ((x)->type == TYPE_SEQ)
-#define is_tbl(x)  ((x)->type == TYPE_TBL)
-#define is_rfn(x)  ((x)->type == TYPE_RFN)
-#define is_cfn(x)  ((x)->type == TYPE_CFN)
-#define is_num(x)  ((x)->type == TYPE_INT || (x)->type == TYPE_FLT)
-#define is_fn(x)   ((x)->type == TYPE_RFN || (x)->type == TYPE_CFN)
-
 typedef double  rf_flt;
 typedef int64_t rf_int;
 
+typedef struct rf_obj rf_obj;
+
+// Common header for objects managed by the garbage collector. Must be
+// the first member of any collectable struct.
+struct rf_obj {
+    rf_obj  *next;  // Next object in the collector's list
+    uint8_t  type;  // TYPE_STR, TYPE_SEQ, TYPE_TBL or TYPE_INT (boxed)
+    uint8_t  mark;  // Mark epoch of the last collection to reach it
+};
+
+// A string's bytes are stored right after its header, so creating a
+// string takes a single allocation. `str` points to `buf`, except in
+// the few headers built around constant strings at compile time.
+//
+// Strings are immutable once created. Operations which produce a
+// different string (concatenation, substrings, case conversion, etc.)
+// always create a new one, so a string is shared freely by variables,
+// table slots and constants rather than copied. The exception is a
+// string built by repeated concatenation, whose bytes are in a buffer
+// shared with the strings it was built from (see s_append()).
 typedef struct {
+    rf_obj    o;
     size_t    l;
     uint32_t  hash;
+    uint8_t   interned; // Canonical copy of its contents? (see s_intern())
+    uint8_t   cat;      // Result of a concatenation?
+    uint8_t   shared;   // Bytes in a shared buffer? (see str.c)
     char     *str;
+    char      buf[];
 } rf_str;
 
+void s_own(rf_str *);
+
+// Every string handed out by as_str() is null-terminated. A string in
+// a shared buffer is only terminated until a longer one is appended
+// to the buffer, after which it gets its own copy of its bytes the
+// next time it's accessed.
+static inline rf_str *s_use(rf_str *s) {
+    if (s->shared && s->str[s->l])
+        s_own(s);
+    return s;
+}
+
 typedef pcre2_code rf_re;
 
 // Standard PCRE2 compile options
@@ -69,6 +94,7 @@ typedef pcre2_code rf_re;
 #define RE_CFLAGS_EXTRA    RE_IGNORE_BAD_ESC
 
 typedef struct {
+    rf_obj o;
     rf_int from;
     rf_int to;
     rf_int itvl;
@@ -78,6 +104,8 @@ typedef struct rf_tbl rf_tbl;
 typedef struct rf_fn  rf_fn;
 typedef struct c_fn   c_fn;
 
+#ifndef NAN_BOXING
+
 typedef struct {
     // Type tag is aligned to the 64-bit boundary to accommodate an
     // implicit type tag in the VM stack element. This is necessary
@@ -96,50 +124,195 @@ typedef struct {
     } u;
 } rf_val;
 
+#define type_of(x) ((x)->type)
+
+#define is_null(x) (!(x)->type)
+#define is_int(x)  ((x)->type == TYPE_INT)
+#define is_flt(x)  ((x)->type == TYPE_FLT)
+#define is_str(x)  ((x)->type == TYPE_STR)
+#define is_re(x)   ((x)->type == TYPE_RE)
+#define is_seq(x)  ((x)->type == TYPE_SEQ)
+#define is_tbl(x)  ((x)->type == TYPE_TBL)
+#define is_rfn(x)  ((x)->type == TYPE_RFN)
+#define is_cfn(x)  ((x)->type == TYPE_CFN)
+
+// Payload of rf_val *x, which must be of the given type. as_strobj()
+// is the string as is, without the terminator as_str() guarantees;
+// the collector uses it, since s_use() may allocate.
+#define as_int(x)  ((x)->u.i)
+#define as_flt(x)  ((x)->u.f)
+#define as_str(x)  s_use((x)->u.s)
+#define as_strobj(x) ((x)->u.s)
+#define as_re(x)   ((x)->u.r)
+#define as_seq(x)  ((x)->u.q)
+#define as_tbl(x)  ((x)->u.t)
+#define as_rfn(x)  ((x)->u.fn)
+#define as_cfn(x)  ((x)->u.cfn)
+
+// rf_val constructors
+#define v_null     ((rf_val) {TYPE_NULL})
+#define v_int(x)   ((rf_val) {TYPE_INT, .u.i   = (x)})
+#define v_flt(x)   ((rf_val) {TYPE_FLT, .u.f   = (x)})
+#define v_str(x)   ((rf_val) {TYPE_STR, .u.s   = (x)})
+#define v_re(x)    ((rf_val) {TYPE_RE,  .u.r   = (x)})
+#define v_seq(x)   ((rf_val) {TYPE_SEQ, .u.q   = (x)})
+#define v_tbl(x)   ((rf_val) {TYPE_TBL, .u.t   = (x)})
+#define v_rfn(x)   ((rf_val) {TYPE_RFN, .u.fn  = (x)})
+#define v_cfn(x)   ((rf_val) {TYPE_CFN, .u.cfn = (x)})
+
+#else
+
+// NaN-boxed values (make -B NAN_BOXING=1)
+//
+// Every value fits in 8 bytes. Floats are stored as-is. Every other
+// type is encoded in the payload of a negative quiet NaN:
+//
+//   63   62..52      51   50..47  46..0
+//   1    11111111111 1    tag     payload
+//
+// The tag is the value's type (see enum types) and the payload is
+// either a pointer or an integer. Pointers are assumed to fit in 47
+// bits, as they do in user space on x86-64 and most 64-bit ARM
+// configurations. NaNs produced by arithmetic are canonicalized to a
+// positive quiet NaN so they're never mistaken for boxed values.
+//
+// Ints in the range [-2^46, 2^46) are stored inline. Larger ints are
+// boxed in a GC-managed rf_bint and tagged NB_BINT, so the full
+// 64-bit range of rf_int is preserved.
+
+typedef union {
+    uint64_t b;
+    rf_flt   f;
+} rf_val;
+
+typedef struct {
+    rf_obj o;
+    rf_int i;
+} rf_bint;
+
+#define NB_BOX       0xfff8000000000000 // Boxed value prefix
+#define NB_TAGMASK   0xffff800000000000 // Prefix + tag
+#define NB_INTMASK   0xfffb800000000000 // Prefix + tag, minus NB_BINT bit
+#define NB_PAYLOAD   0x00007fffffffffff
+#define NB_NAN       0x7ff8000000000000 // Canonical NaN
+#define NB_BINT      (TYPE_INT | 8)     // Tag for boxed ints
+#define NB_ADDR      (TYPE_CFN + 2)     // Tag for addresses (see vm.h)
+#define NB_TAG(t)    (NB_BOX | ((uint64_t) (t) << 47))
+#define nb_tag(x)    ((int) (((x)->b >> 47) & 0xf))
+#define nb_is(x,t)   (((x)->b & NB_TAGMASK) == NB_TAG(t))
+#define nb_ptr(x)    ((void *) (uintptr_t) ((x)->b & NB_PAYLOAD))
+#define nb_box(t,p)  ((rf_val) {.b = NB_TAG(t) | (uintptr_t) (p)})
+
+#ifdef __GNUC__
+#define nb_likely(x) __builtin_expect(!!(x), 1)
+#else
+#define nb_likely(x) (x)
+#endif
+
+static inline int type_of(rf_val *x) {
+    if ((x->b & NB_BOX) != NB_BOX)
+        return TYPE_FLT;
+    int t = nb_tag(x);
+    return t == NB_BINT ? TYPE_INT : t;
+}
+
+#define is_null(x) ((x)->b == NB_TAG(TYPE_NULL))
+#define is_int(x)  (((x)->b & NB_INTMASK) == NB_TAG(TYPE_INT))
+#define is_flt(x)  (((x)->b & NB_BOX) != NB_BOX)
+#define is_str(x)  nb_is(x, TYPE_STR)
+#define is_re(x)   nb_is(x, TYPE_RE)
+#define is_seq(x)  nb_is(x, TYPE_SEQ)
+#define is_tbl(x)  nb_is(x, TYPE_TBL)
+#define is_rfn(x)  nb_is(x, TYPE_RFN)
+#define is_cfn(x)  nb_is(x, TYPE_CFN)
+#define is_bint(x) nb_is(x, NB_BINT)
+
+static inline rf_int nb_int(rf_val *x) {
+    if (nb_likely(nb_is(x, TYPE_INT)))
+        return (rf_int) (x->b << 17) >> 17; // Sign-extend payload
+    return ((rf_bint *) nb_ptr(x))->i;
+}
+
+#define as_int(x)  nb_int(x)
+#define as_flt(x)  ((rf_flt) (x)->f)
+#define as_str(x)  s_use((rf_str *) nb_ptr(x))
+#define as_strobj(x) ((rf_str *) nb_ptr(x))
+#define as_re(x)   ((rf_re *)  nb_ptr(x))
+#define as_seq(x)  ((rf_seq *) nb_ptr(x))
+#define as_tbl(x)  ((rf_tbl *) nb_ptr(x))
+#define as_rfn(x)  ((rf_fn *)  nb_ptr(x))
+#define as_cfn(x)  ((c_fn *)   nb_ptr(x))
+#define as_bint(x) ((rf_bint *) nb_ptr(x))
+
+rf_val v_bint(rf_int);
+
+static inline rf_val nb_int_val(rf_int i) {
+    if (nb_likely(((uint64_t) i + ((uint64_t) 1 << 46)) >> 47 == 0))
+        return (rf_val) {.b = NB_TAG(TYPE_INT) | ((uint64_t) i & NB_PAYLOAD)};
+    return v_bint(i);
+}
+
+static inline rf_val nb_flt_val(rf_flt f) {
+    return f == f ? (rf_val) {.f = f} : (rf_val) {.b = NB_NAN};
+}
+
+#define v_null     ((rf_val) {.b = NB_TAG(TYPE_NULL)})
+#define v_int(x)   nb_int_val(x)
+#define v_flt(x)   nb_flt_val(x)
+#define v_str(x)   nb_box(TYPE_STR, x)
+#define v_re(x)    nb_box(TYPE_RE,  x)
+#define v_seq(x)   nb_box(TYPE_SEQ, x)
+#define v_tbl(x)   nb_box(TYPE_TBL, x)
+#define v_rfn(x)   nb_box(TYPE_RFN, x)
+#define v_cfn(x)   nb_box(TYPE_CFN, x)
+
+#endif
+
+#define is_num(x)  (is_int(x) || is_flt(x))
+#define is_fn(x)   (is_rfn(x) || is_cfn(x))
+
 // Assign value x to rf_val *p
-#define assign_null(p)   (p)->type = TYPE_NULL
-#define assign_int(p, x) *(p) = (rf_val) {TYPE_INT, .u.i = (x)}
-#define assign_flt(p, x) *(p) = (rf_val) {TYPE_FLT, .u.f = (x)}
-#define assign_str(p, x) *(p) = (rf_val) {TYPE_STR, .u.s = (x)}
-
-#define numval(x) (is_int(x) ? (x)->u.i : \
-                   is_flt(x) ? (x)->u.f : \
-                   is_str(x) ? str2flt((x)->u.s) : 0)
-#define intval(x) (is_int(x) ? (x)->u.i : \
-                   is_flt(x) ? (rf_int) (x)->u.f : \
-                   is_str(x) ? str2int((x)->u.s) : 0)
-#define fltval(x) (is_flt(x) ? (x)->u.f : \
-                   is_int(x) ? (rf_flt) (x)->u.i : \
-                   is_str(x) ? str2flt((x)->u.s) : 0)
+#define assign_null(p)   *(p) = v_null
+#define assign_int(p, x) *(p) = v_int(x)
+#define assign_flt(p, x) *(p) = v_flt(x)
+#define assign_str(p, x) *(p) = v_str(x)
+
+#define numval(x) (is_int(x) ? as_int(x) : \
+                   is_flt(x) ? as_flt(x) : \
+                   is_str(x) ? str2flt(as_str(x)) : 0)
+#define intval(x) (is_int(x) ? as_int(x) : \
+                   is_flt(x) ? (rf_int) as_flt(x) : \
+                   is_str(x) ? str2int(as_str(x)) : 0)
+#define fltval(x) (is_flt(x) ? as_flt(x) : \
+                   is_int(x) ? (rf_flt) as_int(x) : \
+                   is_str(x) ? str2flt(as_str(x)) : 0)
 
 // == and != operators
 #define cmp_eq(l,r,op) \
     if (is_null(l) ^ is_null(r)) { \
         assign_int(l, !(0 op 0)); \
     } else if (is_str(l) && is_str(r)) { \
-        if (!l->u.s->hash) l->u.s->hash = u_strhash(l->u.s->str); \
-        if (!r->u.s->hash) r->u.s->hash = u_strhash(r->u.s->str); \
-        assign_int(l, (l->u.s->hash op r->u.s->hash)); \
+        assign_int(l, (s_eq(as_str(l), as_str(r)) op 1)); \
     } else if (is_str(l) && !is_str(r)) { \
-        if (!l->u.s->l) { \
+        if (!as_str(l)->l) { \
             assign_int(l, !(0 op 0)); \
             return; \
         } \
         char *end; \
-        rf_flt f = u_str2d(l->u.s->str, &end, 0); \
-        if (*end != '\0') { \
+        rf_flt f = u_str2d(as_str(l)->str, &end, 0); \
+        if (end != as_str(l)->str + as_str(l)->l) { \
             assign_int(l, 0); \
         } else { \
             assign_int(l, (f op numval(r))); \
         } \
     } else if (!is_str(l) && is_str(r)) { \
-        if (!r->u.s->l) { \
+        if (!as_str(r)->l) { \
             assign_int(l, !(0 op 0)); \
             return; \
         } \
         char *end; \
-        rf_flt f = u_str2d(r->u.s->str, &end, 0); \
-        if (*end != '\0') { \
+        rf_flt f = u_str2d(as_str(r)->str, &end, 0); \
+        if (end != as_str(r)->str + as_str(r)->l) { \
             assign_int(l, 0); \
         } else { \
             assign_int(l, (numval(l) op f)); \
@@ -154,19 +327,24 @@ typedef struct {
 rf_int  str2int(rf_str *);
 rf_flt  str2flt(rf_str *);
 void    re_register_fldv(rf_tbl *);
-rf_re  *re_compile(char *, uint32_t, int *);
+rf_re  *re_compile(char *, size_t, uint32_t, int *);
 void    re_free(rf_re *);
 int     re_store_numbered_captures(pcre2_match_data *);
-rf_int  re_match(char *, rf_re *, int);
+rf_int  re_match(char *, size_t, rf_re *, int);
+rf_str *s_alloc(size_t);
+int     s_eq(rf_str *, rf_str *);
 rf_str *s_newstr(const char *, size_t, int);
-rf_str *s_newstr_concat(char *, char *, int);
-rf_str *s_substr(char *, rf_int, rf_int, rf_int);
+rf_str *s_newstr_concat(const char *, size_t, const char *, size_t, int);
+rf_str *s_append(rf_str *, const char *, size_t);
+rf_str *s_substr(const char *, size_t, rf_int, rf_int, rf_int);
 rf_str *s_int2str(rf_int);
 rf_str *s_flt2str(rf_flt);
+rf_str *s_intern(rf_str *);
+rf_str *s_internstr(const char *, size_t);
+void    s_free(rf_str *);
 rf_val *v_newnull(void);
 rf_val *v_newint(rf_int);
 rf_val *v_newflt(rf_flt);
 rf_val *v_newstr(rf_str *);
-rf_val *v_newtbl(void);
 
 #endif
@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 
@@ -21,14 +22,81 @@ char *u_file2str(const char *path) {
     return buf;
 }
 
-// djb2
-// source: http://www.cse.yorku.ca/~oz/hash.html
-uint32_t u_strhash(const char *str) {
-    uint32_t h = 5381;
-    unsigned int c;
-    while ((c = *str++))
-        h = ((h << 5) + h) + c;
-    return h;
+// Seed mixed into every string hash (see u_seedhash())
+static uint64_t hashseed;
+
+#define P0 0xa0761d6478bd642full
+#define P1 0xe7037ed1a0b428dbull
+
+// 64x64->128-bit multiply, folded to 64 bits
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t) a;
+    uint64_t hb = b >> 32, lb = (uint32_t) b;
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+    uint64_t t  = ll + (hl << 32);
+    uint64_t lo = t + (lh << 32);
+    uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (t < ll) + (lo < t);
+    return lo ^ hi;
+#endif
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Seed the string hash function. Seeding it differently on each run
+// keeps the placement of string keys in a table unpredictable, so an
+// input can't be crafted to make them all collide.
+void u_seedhash(uint64_t seed) {
+    hashseed = seed ^ mix(seed ^ P0, P1);
+}
+
+// Hash a 64-bit word: an int, or the bits of a float or pointer
+uint32_t u_wordhash(uint64_t x) {
+    uint64_t h = mix(x ^ hashseed, P1);
+    return (uint32_t) (h ^ (h >> 32));
+}
+
+// Hash the `l` bytes at `str`. Adapted from wyhash (public domain):
+// strings are consumed 16 bytes at a time, each block folded into the
+// state with a single wide multiply. Never returns 0, which marks a
+// string whose hash hasn't been computed.
+uint32_t u_strhash(const char *str, size_t l) {
+    const uint8_t *p = (const uint8_t *) str;
+    uint64_t seed = hashseed, a, b;
+    if (l <= 16) {
+        if (l >= 4) {
+            size_t d = (l >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + d);
+            b = (read32(p + l - 4) << 32) | read32(p + l - 4 - d);
+        } else if (l) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[l >> 1] << 8) | p[l - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = l;
+        for (; i > 16; i -= 16, p += 16)
+            seed = mix(read64(p) ^ P1, read64(p + 8) ^ seed);
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    uint64_t h = mix(mix(a ^ P1, b ^ seed) ^ P0 ^ l, P1);
+    uint32_t r = (uint32_t) (h ^ (h >> 32));
+    return r ? r : 1;
 }
 
 int u_decval(int c) {
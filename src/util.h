@@ -2,13 +2,16 @@
 #define UTIL_H
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define u_int2str(i,b,n) snprintf(b, n, "%"PRId64, i)
 #define u_flt2str(f,b,n) snprintf(b, n, "%g", f)
 
 char     *u_file2str(const char *);
-uint32_t  u_strhash(const char *);
+void      u_seedhash(uint64_t);
+uint32_t  u_strhash(const char *, size_t);
+uint32_t  u_wordhash(uint64_t);
 int       u_decval(int);
 int       u_hexval(int);
 int       u_baseval(int, int);
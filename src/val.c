@@ -1,36 +1,37 @@
+#include "mem.h"
 #include "table.h"
 #include "types.h"
 
 rf_val *v_newnull(void) {
     rf_val *v = malloc(sizeof(rf_val));
-    *v = (rf_val) {TYPE_NULL, .u.s = NULL};
+    *v = v_null;
     return v;
 }
 
 rf_val *v_newint(rf_int i) {
     rf_val *v = malloc(sizeof(rf_val));
-    *v = (rf_val) {TYPE_INT, .u.i = i};
+    *v = v_int(i);
     return v;
 }
 
 rf_val *v_newflt(rf_flt f) {
     rf_val *v = malloc(sizeof(rf_val));
-    *v = (rf_val) {TYPE_FLT, .u.f = f};
+    *v = v_flt(f);
     return v;
 }
 
 rf_val *v_newstr(rf_str *s) {
-    rf_str *ns   = s_newstr(s->str, s->l, 0);
-    rf_val *v    = malloc(sizeof(rf_val));
-    *v = (rf_val) {TYPE_STR, .u.s = ns};
-    v->u.s->hash = s->hash;
+    rf_val *v = malloc(sizeof(rf_val));
+    *v = v_str(s);
     return v;
 }
 
-rf_val *v_newtbl(void) {
-    rf_val *v = malloc(sizeof(rf_val));
-    rf_tbl *t = malloc(sizeof(rf_tbl));
-    t_init(t);
-    *v = (rf_val) {TYPE_TBL, .u.t = t};
-    return v;
+#ifdef NAN_BOXING
+// Box an int too large to be stored inline
+rf_val v_bint(rf_int i) {
+    rf_bint *b = malloc(sizeof(rf_bint));
+    m_track(&b->o, TYPE_INT);
+    b->i = i;
+    return nb_box(NB_BINT, b);
 }
+#endif
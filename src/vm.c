@@ -1,5 +1,6 @@
 #include <inttypes.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,11 +17,51 @@ static void err(const char *msg) {
     exit(1);
 }
 
-static rf_htbl   globals;
+static rf_env   *env;
+static rf_val   *globals; // Indexed by symbol table slot
 static rf_tbl    argv;
 static rf_tbl    fldv;
-static rf_iter  *iter;
-static rf_stack  stack[VM_STACK_SIZE];
+static rf_iter  *iter;    // Current loop iterator (top of `iters`)
+static rf_stack *stack;
+static rf_stack *stack_end;
+
+// Addresses of table slots pushed by OP_IDXA and OP_FLDA are only
+// valid until the slots are moved (see t_moved). Any such address
+// still live on the stack lies within stack[lo..top).
+static ptrdiff_t lo;
+static ptrdiff_t top;
+
+// Table owning the slot whose address is in the same element of the
+// stack. Only meaningful for elements holding such an address (see
+// set_slot()); the collector marks these tables, since a table may be
+// reachable only through an address on the stack, e.g. the table in
+// `t[0] = (t = null) + f()` while f() runs.
+static rf_tbl  **owner;
+
+// Table slot most recently pushed by OP_IDXA or OP_FLDA which hasn't
+// been written to yet. Writes through it are reported to the table so
+// it can keep its element count current (see t_wrote()).
+static struct {
+    rf_tbl *t;
+    rf_val *p;      // NULL if there is no such slot
+    int     null;   // Was the slot null when pushed?
+} ws;
+
+// Call frame stack
+static struct {
+    int       n;
+    int       cap;
+    rf_frame *f;
+} frames;
+
+// Loop iterator stack. Iterators are created and destroyed in LIFO
+// order, so entering and leaving a loop only moves the top of the
+// stack.
+static struct {
+    int      n;
+    int      cap;
+    rf_iter *i;
+} iters;
 
 // Coerce string to int unconditionally
 inline rf_int str2int(rf_str *s) {
@@ -37,7 +78,7 @@ inline rf_flt str2flt(rf_str *s) {
 // Integer arithmetic (Bitwise ops)
 #define int_arith(l,r,op) \
     if (is_int(l) && is_int(r)) { \
-        l->u.i = (l->u.i op r->u.i); \
+        assign_int(l, (as_int(l) op as_int(r))); \
     } else { \
         assign_int(l, (intval(l) op intval(r))); \
     }
@@ -49,28 +90,39 @@ inline rf_flt str2flt(rf_str *s) {
 // "Polymorphic" arithmetic (add, sub, mul)
 #define num_arith(l,r,op) \
     if (is_int(l) && is_int(r)) { \
-        l->u.i = (l->u.i op r->u.i); \
+        assign_int(l, (as_int(l) op as_int(r))); \
     } else { \
         assign_flt(l, (numval(l) op numval(r))); \
     }
 
+// Length of table `t`. If the slot in `ws` belongs to `t`, whatever
+// has been written to it so far is accounted for first, so a pending
+// write never leaves the count stale.
+static rf_int tbl_length(rf_tbl *t) {
+    if (ws.p && ws.t == t) {
+        t_wrote(t, ws.p, ws.null);
+        ws.null = is_null(ws.p);
+    }
+    return t_length(t);
+}
+
 // Return logical result of value
 static inline int test(rf_val *v) {
-    switch (v->type) {
-    case TYPE_INT: return !!(v->u.i);
-    case TYPE_FLT: return !!(v->u.f);
+    switch (type_of(v)) {
+    case TYPE_INT: return !!(as_int(v));
+    case TYPE_FLT: return !!(as_flt(v));
 
     // If entire string is a numeric value, return logical result of
     // the number. Otherwise, return whether the string is longer than
     // 0.
     case TYPE_STR: {
         char *end;
-        rf_flt f = u_str2d(v->u.s->str, &end, 0);
-        if (*end == '\0')
+        rf_flt f = u_str2d(as_str(v)->str, &end, 0);
+        if (end == as_str(v)->str + as_str(v)->l)
             return !!f;
-        return !!v->u.s->l;
+        return !!as_str(v)->l;
     }
-    case TYPE_TBL: return !!t_length(v->u.t);
+    case TYPE_TBL: return !!tbl_length(as_tbl(v));
     case TYPE_RE:  case TYPE_SEQ:
     case TYPE_RFN: case TYPE_CFN:
         return 1;
@@ -109,10 +161,10 @@ static inline void z_shl(rf_val *l, rf_val *r) { int_arith(l,r,<<); }
 static inline void z_shr(rf_val *l, rf_val *r) { int_arith(l,r,>>); }
 
 static inline void z_num(rf_val *v) {
-    switch (v->type) {
+    switch (type_of(v)) {
     case TYPE_INT: case TYPE_FLT: break;
     case TYPE_STR:
-        assign_flt(v, str2flt(v->u.s));
+        assign_flt(v, str2flt(as_str(v)));
         break;
     default:
         assign_int(v, 0);
@@ -121,15 +173,15 @@ static inline void z_num(rf_val *v) {
 }
 
 static inline void z_neg(rf_val *v) {
-    switch (v->type) {
+    switch (type_of(v)) {
     case TYPE_INT:
-        v->u.i = -v->u.i;
+        assign_int(v, -as_int(v));
         break;
     case TYPE_FLT:
-        v->u.f = -v->u.f;
+        assign_flt(v, -as_flt(v));
         break;
     case TYPE_STR:
-        assign_flt(v, -str2flt(v->u.s));
+        assign_flt(v, -str2flt(as_str(v)));
         break;
     default:
         assign_int(v, 0);
@@ -154,21 +206,21 @@ static inline void z_lnot(rf_val *v) {
 
 static inline void z_len(rf_val *v) {
     rf_int l = 0;
-    switch (v->type) {
+    switch (type_of(v)) {
 
     // For integers:
     //   #x = ⌊log10(x)⌋  + 1 for x > 0
     //        ⌊log10(-x)⌋ + 2 for x < 0
     case TYPE_INT:
-        l = v->u.i > 0 ? (rf_int) log10(v->u.i)  + 1 :
-            v->u.i < 0 ? (rf_int) log10(-v->u.i) + 2 : 1;
+        l = as_int(v) > 0 ? (rf_int) log10(as_int(v))  + 1 :
+            as_int(v) < 0 ? (rf_int) log10(-as_int(v)) + 2 : 1;
         break;
     case TYPE_FLT:
-        l = (rf_int) snprintf(NULL, 0, "%g", v->u.f);
+        l = (rf_int) snprintf(NULL, 0, "%g", as_flt(v));
         break;
-    case TYPE_STR: l = v->u.s->l;        break;
-    case TYPE_TBL: l = t_length(v->u.t); break;
-    case TYPE_RFN: l = v->u.fn->code->n; break; // # of bytes
+    case TYPE_STR: l = as_str(v)->l;          break;
+    case TYPE_TBL: l = tbl_length(as_tbl(v)); break;
+    case TYPE_RFN: l = as_rfn(v)->code->n; break; // # of bytes
     case TYPE_RE:   // TODO - extract something from PCRE pattern?
     case TYPE_SEQ:  // TODO
     case TYPE_CFN:
@@ -187,50 +239,55 @@ static inline void z_cat(rf_val *l, rf_val *r) {
     char *lhs, *rhs;
     char temp_lhs[32];
     char temp_rhs[32];
-    if (!is_str(l)) {
-        switch (l->type) {
-        case TYPE_INT: u_int2str(l->u.i, temp_lhs, 32); break;
-        case TYPE_FLT: u_flt2str(l->u.f, temp_lhs, 32); break;
-        default:       temp_lhs[0] = '\0';              break;
-        }
-        lhs = temp_lhs;
-    } else {
-        lhs = l->u.s->str;
-    }
+    size_t llen = 0, rlen = 0;
 
     if (!is_str(r)) {
-        switch (r->type) {
-        case TYPE_INT: u_int2str(r->u.i, temp_rhs, 32); break;
-        case TYPE_FLT: u_flt2str(r->u.f, temp_rhs, 32); break;
-        default:       temp_rhs[0] = '\0';              break;
+        switch (type_of(r)) {
+        case TYPE_INT: rlen = u_int2str(as_int(r), temp_rhs, 32); break;
+        case TYPE_FLT: rlen = u_flt2str(as_flt(r), temp_rhs, 32); break;
+        default:       temp_rhs[0] = '\0';                     break;
         }
         rhs = temp_rhs;
     } else {
-        rhs = r->u.s->str;
+        rhs  = as_str(r)->str;
+        rlen = as_str(r)->l;
     }
 
-    assign_str(l, s_newstr_concat(lhs, rhs, 0));
+    // Appending to a string may not need to copy it (see s_append())
+    if (is_str(l)) {
+        assign_str(l, s_append(as_str(l), rhs, rlen));
+        return;
+    }
+    switch (type_of(l)) {
+    case TYPE_INT: llen = u_int2str(as_int(l), temp_lhs, 32); break;
+    case TYPE_FLT: llen = u_flt2str(as_flt(l), temp_lhs, 32); break;
+    default:       temp_lhs[0] = '\0';                     break;
+    }
+    lhs = temp_lhs;
+    assign_str(l, s_newstr_concat(lhs, llen, rhs, rlen, 0));
 }
 
 static rf_int match(rf_val *l, rf_val *r) {
 
     // Common case: LHS string, RHS regex
     if (is_str(l) && is_re(r))
-        return re_match(l->u.s->str, r->u.r, 1);
+        return re_match(as_str(l)->str, as_str(l)->l, as_re(r), 1);
 
     char *lhs;
     char temp_lhs[32];
     char temp_rhs[32];
+    size_t llen = 0, rlen = 0;
 
     if (!is_str(l)) {
-        switch (l->type) {
-        case TYPE_INT: u_int2str(l->u.i, temp_lhs, 32); break;
-        case TYPE_FLT: u_flt2str(l->u.f, temp_lhs, 32); break;
+        switch (type_of(l)) {
+        case TYPE_INT: llen = u_int2str(as_int(l), temp_lhs, 32); break;
+        case TYPE_FLT: llen = u_flt2str(as_flt(l), temp_lhs, 32); break;
         default:       temp_lhs[0] = '\0'; break;
         }
         lhs = temp_lhs;
     } else {
-        lhs = l->u.s->str;
+        lhs  = as_str(l)->str;
+        llen = as_str(l)->l;
     }
 
     if (!is_re(r)) {
@@ -238,22 +295,22 @@ static rf_int match(rf_val *l, rf_val *r) {
         rf_int res;
         int errcode;
         int capture = 0;
-        switch (r->type) {
-        case TYPE_INT: u_int2str(r->u.i, temp_rhs, 32); break;
-        case TYPE_FLT: u_flt2str(r->u.f, temp_rhs, 32); break;
+        switch (type_of(r)) {
+        case TYPE_INT: rlen = u_int2str(as_int(r), temp_rhs, 32); break;
+        case TYPE_FLT: rlen = u_flt2str(as_flt(r), temp_rhs, 32); break;
         case TYPE_STR:
             capture = 1;
-            temp_re = re_compile(r->u.s->str, 0, &errcode);
+            temp_re = re_compile(as_str(r)->str, as_str(r)->l, 0, &errcode);
             goto do_match;
         default:       temp_rhs[0] = '\0'; break;
         }
-        temp_re = re_compile(temp_rhs, 0, &errcode);
+        temp_re = re_compile(temp_rhs, rlen, 0, &errcode);
 do_match:
-        res = re_match(lhs, temp_re, capture);
+        res = re_match(lhs, llen, temp_re, capture);
         re_free(temp_re);
         return res;
     } else {
-        return re_match(lhs, r->u.r, 1);
+        return re_match(lhs, llen, as_re(r), 1);
     }
 }
 
@@ -267,14 +324,13 @@ static inline void z_nmatch(rf_val *l, rf_val *r) {
 
 static inline void z_idx(rf_val *l, rf_val *r) {
     char temp[32];
-    switch (l->type) {
+    switch (type_of(l)) {
     case TYPE_INT: {
-        u_int2str(l->u.i, temp, 32);
+        rf_int len = u_int2str(as_int(l), temp, 32);
         if (is_seq(r)) {
-            assign_str(l, s_substr(temp, r->u.q->from, r->u.q->to, r->u.q->itvl));
+            assign_str(l, s_substr(temp, len, as_seq(r)->from, as_seq(r)->to, as_seq(r)->itvl));
         } else {
             rf_int r1  = intval(r);
-            rf_int len = (rf_int) strlen(temp);
             if (r1 < 0)
                 r1 += len;
             if (r1 > len - 1 || r1 < 0)
@@ -285,12 +341,11 @@ static inline void z_idx(rf_val *l, rf_val *r) {
         break;
     }
     case TYPE_FLT: {
-        u_flt2str(l->u.f, temp, 32);
+        rf_int len = u_flt2str(as_flt(l), temp, 32);
         if (is_seq(r)) {
-            assign_str(l, s_substr(temp, r->u.q->from, r->u.q->to, r->u.q->itvl));
+            assign_str(l, s_substr(temp, len, as_seq(r)->from, as_seq(r)->to, as_seq(r)->itvl));
         } else {
             rf_int r1  = intval(r);
-            rf_int len = (rf_int) strlen(temp);
             if (r1 < 0)
                 r1 += len;
             if (r1 > len - 1 || r1 < 0)
@@ -302,28 +357,28 @@ static inline void z_idx(rf_val *l, rf_val *r) {
     }
     case TYPE_STR: {
         if (is_seq(r)) {
-            l->u.s = s_substr(l->u.s->str, r->u.q->from, r->u.q->to, r->u.q->itvl);
+            assign_str(l, s_substr(as_str(l)->str, as_str(l)->l, as_seq(r)->from, as_seq(r)->to, as_seq(r)->itvl));
         } else {
             rf_int r1  = intval(r);
-            rf_int len = (rf_int) l->u.s->l;
+            rf_int len = (rf_int) as_str(l)->l;
             if (r1 < 0)
                 r1 += len;
             if (r1 > len - 1 || r1 < 0)
                 assign_null(l);
             else
-                l->u.s = s_newstr(&l->u.s->str[r1], 1, 0);
+                assign_str(l, s_newstr(&as_str(l)->str[r1], 1, 0));
         }
         break;
     }
     case TYPE_TBL:
-        *l = *t_lookup(l->u.t, r, 0);
+        *l = *t_lookup(as_tbl(l), r, 0);
         break;
     case TYPE_RFN: {
         rf_int r1 = intval(r);
-        if (r1 > l->u.fn->code->n - 1 || r1 < 0)
+        if (r1 > as_rfn(l)->code->n - 1 || r1 < 0)
             assign_null(l);
         else
-            assign_int(l, l->u.fn->code->code[r1]);
+            assign_int(l, as_rfn(l)->code->code[r1]);
         break;
     }
     default:
@@ -334,76 +389,79 @@ static inline void z_idx(rf_val *l, rf_val *r) {
 
 // OP_PRINT functionality
 static inline void z_print(rf_val *v) {
-    switch (v->type) {
+    switch (type_of(v)) {
     case TYPE_NULL: printf("null");                 break;
-    case TYPE_INT:  printf("%"PRId64, v->u.i);      break;
-    case TYPE_FLT:  printf(FLT_PRINT_FMT, v->u.f);  break;
-    case TYPE_STR:  printf("%s", v->u.s->str);      break;
-    case TYPE_RE:   printf("regex: %p", v->u.r);    break;
+    case TYPE_INT:  printf("%"PRId64, as_int(v));      break;
+    case TYPE_FLT:  printf(FLT_PRINT_FMT, as_flt(v));  break;
+    case TYPE_STR:  fwrite(as_str(v)->str, 1, as_str(v)->l, stdout); break;
+    case TYPE_RE:   printf("regex: %p", as_re(v));    break;
     case TYPE_SEQ:
         printf("seq: %"PRId64"..%"PRId64":%"PRId64,
-                v->u.q->from, v->u.q->to, v->u.q->itvl);
+                as_seq(v)->from, as_seq(v)->to, as_seq(v)->itvl);
         break;
-    case TYPE_TBL:  printf("table: %p", v->u.t);    break;
-    case TYPE_RFN:  printf("fn: %p", v->u.fn);      break;
-    case TYPE_CFN:  printf("fn: %p", v->u.cfn);     break;
+    case TYPE_TBL:  printf("table: %p", as_tbl(v));    break;
+    case TYPE_RFN:  printf("fn: %p", as_rfn(v));      break;
+    case TYPE_CFN:  printf("fn: %p", as_cfn(v));     break;
     default: break;
     }
 }
 
+// Number of iterations over the sequence from..to with nonzero
+// interval `itvl`. The distance between the bounds is computed in
+// uint64_t, since it overflows an rf_int for open-ended sequences
+// (e.g. `0..`, which runs to INT64_MAX) and sequences spanning zero.
+// A sequence whose bounds run opposite to its interval never ends;
+// neither does one with 2^64 elements. Both return UINT64_MAX.
+static inline uint64_t seq_len(rf_int from, rf_int to, rf_int itvl) {
+    if (itvl > 0 ? to < from : from < to)
+        return UINT64_MAX;
+    uint64_t d = itvl > 0 ? (uint64_t) to - (uint64_t) from
+                          : (uint64_t) from - (uint64_t) to;
+    uint64_t n = d / (itvl > 0 ? (uint64_t) itvl : -(uint64_t) itvl);
+    return n < UINT64_MAX ? n + 1 : n;
+}
+
 static inline void new_iter(rf_val *set) {
-    rf_iter *new = malloc(sizeof(rf_iter));
-    new->p = iter;
-    iter = new;
-    switch (set->type) {
+    m_growarray(iters.i, iters.n, iters.cap, rf_iter);
+    iter = &iters.i[iters.n++];
+    iter->sv = *set;
+    switch (type_of(set)) {
     case TYPE_FLT:
-        set->u.i = (rf_int) set->u.f;
+        assign_int(set, (rf_int) as_flt(set));
         // Fall-through
     case TYPE_INT:
-        iter->keys = NULL;
         iter->t = LOOP_SEQ;
         iter->st = 0;
-        if (set->u.i >= 0) {
-            iter->n = set->u.i + 1; // Inclusive
+        if (as_int(set) >= 0) {
+            iter->n = as_int(set) + 1; // Inclusive
             iter->set.itvl = 1;
         } else {
-            iter->n = -(set->u.i) + 1; // Inclusive
+            iter->n = -(as_int(set)) + 1; // Inclusive
             iter->set.itvl = -1;
         }
         break;
     case TYPE_STR:
         iter->t = LOOP_STR;
-        iter->n = set->u.s->l;
-        iter->keys = NULL;
-        iter->set.str = set->u.s->str;
+        iter->n = as_str(set)->l;
+        iter->set.str = as_str(set);
         break;
     case TYPE_RE:
         err("cannot iterate over regular expression");
     case TYPE_SEQ:
-        iter->keys = NULL;
         iter->t = LOOP_SEQ;
-        iter->set.itvl = set->u.q->itvl;
-        if (iter->set.itvl > 0)
-            iter->on = (set->u.q->to - set->u.q->from) + 1;
-        else
-            iter->on = (set->u.q->from - set->u.q->to) + 1;
-        if (iter->on <= 0)
-            iter->n = UINT64_MAX; // TODO "Infinite" loop
-        else
-            iter->n = (uint64_t) ceil(fabs(iter->on / (double) iter->set.itvl));
-        iter->st = set->u.q->from;
+        iter->set.itvl = as_seq(set)->itvl;
+        iter->n = seq_len(as_seq(set)->from, as_seq(set)->to, iter->set.itvl);
+        iter->st = as_seq(set)->from;
         break;
     case TYPE_TBL:
         iter->t = LOOP_TBL;
-        iter->on = iter->n = t_length(set->u.t);
-        iter->keys = t_collect_keys(set->u.t);
-        iter->set.tbl = set->u.t;
+        t_cursor(as_tbl(set), &iter->cur);
+        iter->set.tbl = as_tbl(set);
         break;
     case TYPE_RFN:
         iter->t = LOOP_FN;
-        iter->n = set->u.fn->code->n;
-        iter->keys = NULL;
-        iter->set.code = set->u.fn->code->code;
+        iter->n = as_rfn(set)->code->n;
+        iter->set.code = as_rfn(set)->code->code;
         break;
     case TYPE_CFN:
         err("cannot iterate over C function");
@@ -412,30 +470,168 @@ static inline void new_iter(rf_val *set) {
 }
 
 static inline void destroy_iter(void) {
-    rf_iter *old = iter;
-    iter = iter->p;
-    if (old->t == LOOP_TBL) {
-        if (!(old->n + 1)) // Loop completed?
-            free(old->keys - old->on);
+    iter = --iters.n ? &iters.i[iters.n - 1] : NULL;
+}
+
+// Advance the current iterator. Returns 0 once the loop is complete.
+static inline int iter_next(void) {
+    if (iter->t == LOOP_TBL) {
+        rf_val k, *v;
+        if (!t_next(iter->set.tbl, &iter->cur, &k, &v))
+            return 0;
+        if (iter->k != NULL)
+            *iter->k = k;
+        *iter->v = *v;
+        return 1;
+    }
+    if (!iter->n--)
+        return 0;
+    switch (iter->t) {
+    case LOOP_SEQ:
+        if (is_null(iter->v))
+            *iter->v = v_int(iter->st);
         else
-            free(old->keys - (old->on - old->n));
+            assign_int(iter->v, as_int(iter->v) + iter->set.itvl);
+        break;
+    case LOOP_STR:
+        if (iter->k != NULL) {
+            if (is_null(iter->k)) {
+                assign_int(iter->k, 0);
+            } else {
+                assign_int(iter->k, as_int(iter->k) + 1);
+            }
+        }
+        // Index the string's bytes anew each time, since they may
+        // move to a copy of their own (see s_use())
+        *iter->v = v_str(s_newstr(iter->set.str->str +
+                                  iter->set.str->l - iter->n - 1, 1, 0));
+        break;
+    case LOOP_FN:
+        if (iter->k != NULL) {
+            if (is_null(iter->k)) {
+                assign_int(iter->k, 0);
+            } else {
+                assign_int(iter->k, as_int(iter->k) + 1);
+            }
+        }
+        if (is_null(iter->v)) {
+            *iter->v = v_int(*iter->set.code++);
+        } else {
+            assign_int(iter->v, *iter->set.code++);
+        }
+        break;
+    default: break;
     }
-    free(old);
+    return 1;
 }
 
+
 // TODO
 static inline void init_argv(rf_tbl *t, rf_int os, int rf_argc, char **rf_argv) {
     t_init(t);
     for (rf_int i = 0; i < rf_argc; ++i) {
         rf_str *s = s_newstr(rf_argv[i], strlen(rf_argv[i]), 1);
+        rf_val  v = v_str(s);
         // TODO - this doesn't work correctly without directly
         // deferring to h_insert for negative indices NOR without
         // forcing insertion for non-negeative indices.
-        if (i-os-1 < 0)
-            h_insert(t->h, s_int2str(i-os-1), v_newstr(s), 1);
-        else
-            t_insert_int(t, (rf_int)i-os-1, v_newstr(s), 1, 1);
-        m_freestr(s);
+        if (i-os-1 < 0) {
+            rf_val k = v_int(i-os-1);
+            h_insert(t->h, &k, &v);
+        } else {
+            t_insert_int(t, (rf_int)i-os-1, &v, 1);
+        }
+    }
+}
+
+// Grow the VM stack to hold at least `need` elements, `n` of which
+// are in use. Every pointer into the stack (frame pointers, iterator
+// slots and addresses of locals pushed on the stack itself) is
+// relocated; the caller is responsible for its own SP and FP.
+static void grow_stack(ptrdiff_t n, ptrdiff_t need) {
+    ptrdiff_t cap = stack_end - stack;
+    while (cap < need)
+        cap *= 2;
+    if (cap > VM_STACK_MAX)
+        err("stack overflow");
+    uintptr_t old = (uintptr_t) stack;
+    uintptr_t end = (uintptr_t) (stack + n);
+    stack = realloc(stack, sizeof(rf_stack) * cap);
+    owner = realloc(owner, sizeof(rf_tbl *) * cap);
+    stack_end = stack + cap;
+
+#define relocate(p) \
+    if ((uintptr_t) (p) >= old && (uintptr_t) (p) < end) \
+        p = (void *) ((uintptr_t) stack + ((uintptr_t) (p) - old));
+
+    for (ptrdiff_t i = 0; i < n; ++i) {
+        if (is_addr(stack[i])) {
+            rf_val *p = addr(stack[i]);
+            relocate(p);
+            set_addr(stack[i], p);
+        }
+    }
+    for (int i = 0; i < frames.n; ++i)
+        relocate(frames.f[i].fp);
+    for (int i = 0; i < iters.n; ++i) {
+        relocate(iters.i[i].k);
+        relocate(iters.i[i].v);
+    }
+}
+
+// Patch up addresses of `n` table slots moved from `old` to `to`
+static void move_slots(uintptr_t old, rf_val *to, size_t n) {
+    uintptr_t end = old + sizeof(rf_val) * n;
+    ptrdiff_t min = top;
+    for (ptrdiff_t i = lo; i < top; ++i) {
+        if (!is_addr(stack[i]))
+            continue;
+        uintptr_t p = (uintptr_t) addr(stack[i]);
+        if (p >= old && p < end)
+            set_addr(stack[i], (rf_val *) ((uintptr_t) to + (p - old)));
+        if (i < min)
+            min = i;
+    }
+    lo = min;
+    if ((uintptr_t) ws.p >= old && (uintptr_t) ws.p < end)
+        ws.p = (rf_val *) ((uintptr_t) to + ((uintptr_t) ws.p - old));
+}
+
+// Does address `a` on the stack point into a table, rather than at a
+// global or local variable?
+static inline int is_slot(rf_val *a) {
+    uintptr_t p = (uintptr_t) a;
+    return (p <  (uintptr_t) globals || p >= (uintptr_t) (globals + c_symtab.n)) &&
+           (p <  (uintptr_t) stack   || p >= (uintptr_t) stack_end);
+}
+
+// Mark every object reachable from the VM: the live portion of the
+// stack (including the tables owning any slots whose addresses are on
+// it), globals, the field and argument tables, active iterators and
+// the constant pools of every code object.
+static void mark_roots(void *ud) {
+    rf_stack *sp = ud;
+    for (rf_stack *p = stack; p < sp; ++p) {
+        if (!is_addr(*p))
+            m_markval(&p->v);
+        else if (is_slot(addr(*p)))
+            m_marktbl(owner[p - stack]);
+    }
+    for (int i = 0; i < c_symtab.n; ++i)
+        m_markval(&globals[i]);
+    m_marktbl(&argv);
+    m_marktbl(&fldv);
+    if (ws.p)
+        m_marktbl(ws.t);
+    for (rf_iter *i = iters.i; i < iters.i + iters.n; ++i)
+        m_markval(&i->sv);
+    rf_code *c = env->main.code;
+    for (int i = 0; i < c->nk; ++i)
+        m_markval(&c->k[i]);
+    for (int i = 0; i < env->nf; ++i) {
+        c = env->fn[i]->code;
+        for (int j = 0; j < c->nk; ++j)
+            m_markval(&c->k[j]);
     }
 }
 
@@ -443,67 +639,190 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp);
 
 // VM entry point/initialization
 int z_exec(rf_env *e) {
-    h_init(&globals);
+    env = e;
+    globals = malloc(sizeof(rf_val) * (c_symtab.n ? c_symtab.n : 1));
+    for (int i = 0; i < c_symtab.n; ++i)
+        assign_null(&globals[i]);
     iter = NULL;
+    iters.n = 0;
+    frames.n = 0;
+    stack = malloc(sizeof(rf_stack) * VM_STACK_SIZE);
+    owner = malloc(sizeof(rf_tbl *) * VM_STACK_SIZE);
+    stack_end = stack + VM_STACK_SIZE;
+    lo = top = 0;
+    ws.p = NULL;
+    t_moved = move_slots;
     t_init(&fldv);
     re_register_fldv(&fldv);
     init_argv(&argv, e->ff, e->argc, e->argv);
-    h_insert(&globals, s_newstr("arg", 3, 1), &(rf_val){TYPE_TBL, .u.t = &argv}, 1);
+    int slot = c_global_slot("arg");
+    if (slot >= 0)
+        globals[slot] = v_tbl(&argv);
 
-    l_register(&globals);
+    l_register(globals);
 
-    // Add user-defined functions to the global hash table
+    // Add user-defined functions to the globals referenced by the
+    // program
     for (int i = 0; i < e->nf; ++i) {
         // Don't add anonymous functions to globals (rf_str should not
         // have a computed hash)
         if (!e->fn[i]->name->hash)
             continue;
-        rf_val *fn = malloc(sizeof(rf_val));
-        *fn = (rf_val) {TYPE_RFN, .u.fn = e->fn[i]};
-        h_insert(&globals, e->fn[i]->name, fn, 1);
+        slot = c_global_slot(e->fn[i]->name->str);
+        if (slot >= 0)
+            globals[slot] = v_rfn(e->fn[i]);
     }
 
+    // Only objects allocated from here on are tracked by the garbage
+    // collector
+    m_init();
     return exec(e->main.code, stack, stack);
 }
 
-#ifndef COMPUTED_GOTO
-#ifdef __GNUC__
+#if defined(VM_GOTO) || defined(VM_THREADED)
 #define COMPUTED_GOTO
 #endif
+
+#ifdef VM_THREADED
+// Translate a code object into direct-threaded code. The label for
+// each opcode is taken from `labels`, the VM's dispatch table.
+// Operands are decoded ahead of time; jump offsets are sign-extended
+// and two-byte operands are combined into one word.
+static void thread_code(rf_code *c, void **labels) {
+    c->tc = malloc(sizeof(rf_word) * (c->n ? c->n : 1));
+    for (int ip = 0; ip < c->n; ip += c_inst_len(c, ip)) {
+        uint8_t *p = &c->code[ip];
+        rf_word *w = &c->tc[ip];
+        w[0].l = labels[p[0]];
+        switch (p[0]) {
+        case OP_JMP8:  case OP_JNZ8: case OP_JZ8:
+        case OP_XJNZ8: case OP_XJZ8:
+            w[1].o = (int8_t) p[1];
+            break;
+        case OP_JMP16:  case OP_JNZ16: case OP_JZ16:
+        case OP_XJNZ16: case OP_XJZ16:
+        case OP_ITERV:  case OP_ITERKV: case OP_ITERN:
+        case OP_EQJZ:   case OP_NEJZ:  case OP_GTJZ:
+        case OP_GEJZ:   case OP_LTJZ:  case OP_LEJZ:
+            w[1].o = (int16_t) ((p[1] << 8) + p[2]);
+            break;
+        case OP_LOOP16: case OP_LOOPN16: case OP_IMM16:
+        case OP_GBLA16: case OP_GBLV16:
+            w[1].o = (p[1] << 8) + p[2];
+            break;
+        case OP_ADDLI: case OP_SUBLI:
+            w[1].o = p[1];
+            w[2].o = p[2];
+            break;
+        default:
+            if (c_inst_len(c, ip) > 1)
+                w[1].o = p[1];
+            break;
+        }
+    }
+}
 #endif
 
 // VM interpreter loop
+// Calls to user-defined functions don't recurse into exec(); the
+// caller's state is saved on the call frame stack and restored by
+// OP_RET/OP_RET1, so the depth of recursion in a riff program is
+// bounded by the VM stack rather than the C stack.
 static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
-    if (sp - stack >= VM_STACK_SIZE)
-        err("stack overflow");
-    rf_stack *retp = sp; // Save original SP
     rf_val *tp; // Temp pointer
-    register uint8_t *ip = c->code;
+
+// Instruction decoding
+//   opnd(n) - nth single-byte operand of the current instruction
+//   opnd16  - two-byte operand (unsigned)
+//   jmp8    - one-byte jump offset (signed)
+//   jmp16   - two-byte jump offset (signed)
+//   op_is   - test the current instruction's opcode (threaded code
+//             consults the original bytecode, since opcodes sharing a
+//             handler share a label)
+//   set_op  - overwrite the current instruction's opcode (quickening)
+//   entry   - first instruction of a code object
+#ifdef VM_THREADED
+#define opnd(n)   (ip[(n)].o)
+#define opnd16    (ip[1].o)
+#define jmp8      (ip[1].o)
+#define jmp16     (ip[1].o)
+#define op_is(x)  (c->code[ip - c->tc] == OP_##x)
+#define set_op(x) (ip->l = dispatch_labels[OP_##x])
+#define entry(c)  ((c)->tc)
+#else
+#define opnd(n)   (ip[(n)])
+#define opnd16    ((ip[1] << 8) + ip[2])
+#define jmp8      ((int8_t) ip[1])
+#define jmp16     ((int16_t) ((ip[1] << 8) + ip[2]))
+#define op_is(x)  (*ip == OP_##x)
+#define set_op(x) (*ip = OP_##x)
+#define entry(c)  ((c)->code)
+#endif
 
 #ifndef COMPUTED_GOTO
 // Use standard while loop with switch/case if computed goto is
 // disabled or unavailable
 #define z_case(l) case OP_##l:
 #define z_break   break
+    register rf_inst *ip = entry(c);
     while (1) { switch (*ip) {
 #else
 #include "labels.h"
+#ifdef VM_THREADED
+    thread_code(env->main.code, dispatch_labels);
+    for (int i = 0; i < env->nf; ++i)
+        thread_code(env->fn[i]->code, dispatch_labels);
+#endif
+    register rf_inst *ip = entry(c);
     dispatch();
 #endif
 
+// Ensure the stack has room for n more elements above SP. Every
+// instruction which pushes onto the stack must check beforehand.
+#define stack_check(n) \
+    if (stack_end - sp < (n)) { \
+        ptrdiff_t spi = sp - stack, fpi = fp - stack; \
+        grow_stack(spi, spi + (n)); \
+        sp = stack + spi; \
+        fp = stack + fpi; \
+    }
+
+// Report a write through address `a` to the table it belongs to, if
+// it's the slot in `ws`
+#define wrote(a) \
+    if ((a) == ws.p) { \
+        t_wrote(ws.t, ws.p, ws.null); \
+        ws.p = NULL; \
+    }
+
+// Expect a write through slot `a` of table `tbl`. If a slot pushed
+// earlier is still waiting for one (e.g. `t[0] = (t[1] = 2)`), it's
+// no longer tracked and its table has to recount its elements.
+#define will_write(tbl, a) \
+    if (ws.p) \
+        t_recount(ws.t); \
+    ws.t    = (tbl); \
+    ws.p    = (a); \
+    ws.null = is_null(ws.p);
+
+// Collect garbage if the heap has outgrown its threshold. This is
+// only checked at jumps and calls; at these points no instruction is
+// holding a reference to an object outside of the VM's roots.
+#define gc_check() if (m_gcdue()) m_collect(mark_roots, sp);
+
 // Unconditional jumps
-#define j8  (ip += (int8_t) ip[1])
-#define j16 (ip += (int16_t) ((ip[1] << 8) + ip[2]))
+#define j8  (ip += jmp8)
+#define j16 (ip += jmp16)
 
-    z_case(JMP8)  j8;  z_break;
-    z_case(JMP16) j16; z_break;
+    z_case(JMP8)  gc_check(); j8;  z_break;
+    z_case(JMP16) gc_check(); j16; z_break;
 
 // Conditional jumps (pop stack unconditionally)
 #define jc8(x)  (x ? j8  : (ip += 2)); --sp;
 #define jc16(x) (x ? j16 : (ip += 3)); --sp;
 
-    z_case(JNZ8)  jc8(test(&sp[-1].v));   z_break;
-    z_case(JNZ16) jc16(test(&sp[-1].v));  z_break;
+    z_case(JNZ8)  gc_check(); jc8(test(&sp[-1].v));  z_break;
+    z_case(JNZ16) gc_check(); jc16(test(&sp[-1].v)); z_break;
     z_case(JZ8)   jc8(!test(&sp[-1].v));  z_break;
     z_case(JZ16)  jc16(!test(&sp[-1].v)); z_break;
 
@@ -516,68 +835,45 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
     z_case(XJZ8)   xjc8(!test(&sp[-1].v));  z_break;
     z_case(XJZ16)  xjc16(!test(&sp[-1].v)); z_break;
 
+// Compare and jump if false (OP_EQ/OP_NE/..; OP_JZ16)
+// Pop both operands unconditionally.
+#define cmpjz(x,op) { \
+    int t; \
+    if (is_int(&sp[-2].v) && is_int(&sp[-1].v)) { \
+        t = as_int(&sp[-2].v) op as_int(&sp[-1].v); \
+    } else { \
+        z_##x(&sp[-2].v, &sp[-1].v); \
+        t = test(&sp[-2].v); \
+    } \
+    sp -= 2; \
+    t ? (ip += 3) : j16; \
+}
+
+    z_case(EQJZ) cmpjz(eq, ==); z_break;
+    z_case(NEJZ) cmpjz(ne, !=); z_break;
+    z_case(GTJZ) cmpjz(gt, >);  z_break;
+    z_case(GEJZ) cmpjz(ge, >=); z_break;
+    z_case(LTJZ) cmpjz(lt, <);  z_break;
+    z_case(LEJZ) cmpjz(le, <=); z_break;
+
     // Initialize/cycle current iterator
     z_case(LOOP8) z_case(LOOP16) {
-        int jmp16 = *ip == OP_LOOP16;
-        if (!iter->n--) {
-            if (jmp16)
+        gc_check();
+        int loop16 = op_is(LOOP16);
+        if (!iter_next()) {
+            if (loop16)
                 ip += 3;
             else
                 ip += 2;
             z_break;
         }
-        switch (iter->t) {
-        case LOOP_SEQ:
-            if (is_null(iter->v))
-                *iter->v = (rf_val) {TYPE_INT, .u.i = iter->st};
-            else
-                iter->v->u.i += iter->set.itvl;
-            break;
-        case LOOP_STR:
-            if (iter->k != NULL) {
-                if (is_null(iter->k)) {
-                    assign_int(iter->k, 0);
-                } else {
-                    iter->k->u.i += 1;
-                }
-            }
-            if (!is_null(iter->v)) {
-                m_freestr(iter->v->u.s);
-                iter->v->u.s = s_newstr(iter->set.str++, 1, 0);
-            } else {
-                *iter->v = (rf_val) {TYPE_STR, .u.s = s_newstr(iter->set.str++, 1, 0)};
-            }
-            break;
-        case LOOP_TBL:
-            if (iter->k != NULL) {
-                *iter->k = *iter->keys;
-            }
-            *iter->v = *t_lookup(iter->set.tbl, iter->keys, 0);
-            iter->keys++;
-            break;
-        case LOOP_FN:
-            if (iter->k != NULL) {
-                if (is_null(iter->k)) {
-                    assign_int(iter->k, 0);
-                } else {
-                    iter->k->u.i += 1;
-                }
-            }
-            if (is_null(iter->v)) {
-                *iter->v = (rf_val) {TYPE_INT, .u.i = *iter->set.code++};
-            } else {
-                iter->v->u.i = *iter->set.code++;
-            }
-            break;
-        default: break;
-        }
 
         // Treat byte(s) following OP_LOOP as unsigned since jumps
         // are always backward
-        if (jmp16)
-            ip -= (ip[1] << 8) + ip[2];
+        if (loop16)
+            ip -= opnd16;
         else
-            ip -= ip[1];
+            ip -= opnd(1);
         z_break;
     }
 
@@ -588,10 +884,64 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
         z_break;
     }
 
+    // Counted loop over a sequence literal. OP_ITERN converts the
+    // bounds SP[-3]..SP[-2] and interval SP[-1] into the loop
+    // variable, iteration count and interval in place, then jumps to
+    // the corresponding OP_LOOPN. The loop variable starts one
+    // interval short of the lower bound, since OP_LOOPN increments it
+    // before every iteration.
+    z_case(ITERN) {
+        rf_int from = intval(&sp[-3].v);
+        rf_int to   = intval(&sp[-2].v);
+        rf_int itvl = intval(&sp[-1].v);
+        if (!itvl)
+            itvl = from > to ? -1 : 1;
+        assign_int(&sp[-3].v, (rf_int) ((uint64_t) from - itvl));
+        assign_int(&sp[-2].v, (rf_int) seq_len(from, to, itvl));
+        assign_int(&sp[-1].v, itvl);
+        j16;
+        z_break;
+    }
+
+    // The loop variable is coerced back to an integer if it was
+    // reassigned inside the loop body
+    z_case(LOOPN8) z_case(LOOPN16) {
+        gc_check();
+        int loop16 = op_is(LOOPN16);
+        uint64_t n = as_int(&sp[-2].v);
+        if (!n) {
+            if (loop16)
+                ip += 3;
+            else
+                ip += 2;
+            z_break;
+        }
+#ifdef NAN_BOXING
+        // A count outside the inline int range (e.g. an open-ended
+        // sequence) is boxed once by OP_ITERN. The box is never
+        // visible outside this slot, so count it down in place rather
+        // than boxing a new int every iteration.
+        if (is_bint(&sp[-2].v))
+            --as_bint(&sp[-2].v)->i;
+        else
+#endif
+        assign_int(&sp[-2].v, (rf_int) (n - 1));
+        if (is_int(&sp[-3].v))
+            assign_int(&sp[-3].v, (rf_int) ((uint64_t) as_int(&sp[-3].v) + as_int(&sp[-1].v)));
+        else
+            assign_int(&sp[-3].v, intval(&sp[-3].v) + as_int(&sp[-1].v));
+        if (loop16)
+            ip -= opnd16;
+        else
+            ip -= opnd(1);
+        z_break;
+    }
+
     // Create iterator and jump to the corresponding OP_LOOP
     // instruction for initialization
     z_case(ITERV) z_case(ITERKV) {
-        int k = *ip == OP_ITERKV;
+        int k = op_is(ITERKV);
+        stack_check(1);
         new_iter(&sp[-1].v); 
         --sp;
         assign_null(&sp++->v);
@@ -628,9 +978,32 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
     --sp; \
     ++ip;
 
-    z_case(ADD)    binop(add);    z_break;
-    z_case(SUB)    binop(sub);    z_break;
-    z_case(MUL)    binop(mul);    z_break;
+// Quickening
+// Rewrite the current instruction in place as its int-int (i) or
+// float-float (f) specialization if the operands' types match. The
+// specialized instruction reverts to the generic one as soon as a
+// pair of operands fails its type guard.
+#define quicken(l,r,i,f) \
+    if (is_int(l) && is_int(r)) \
+        set_op(i); \
+    else if (is_flt(l) && is_flt(r)) \
+        set_op(f);
+
+#define quicken_int(l,r,i) \
+    if (is_int(l) && is_int(r)) \
+        set_op(i);
+
+#define qbinop(x,i,f) \
+    quicken(&sp[-2].v, &sp[-1].v, i, f); \
+    binop(x);
+
+#define qbinop_int(x,i) \
+    quicken_int(&sp[-2].v, &sp[-1].v, i); \
+    binop(x);
+
+    z_case(ADD)    qbinop(add, IADD, FADD); z_break;
+    z_case(SUB)    qbinop(sub, ISUB, FSUB); z_break;
+    z_case(MUL)    qbinop(mul, IMUL, FMUL); z_break;
     z_case(DIV)    binop(div);    z_break;
     z_case(MOD)    binop(mod);    z_break;
     z_case(POW)    binop(pow);    z_break;
@@ -639,72 +1012,113 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
     z_case(XOR)    binop(xor);    z_break;
     z_case(SHL)    binop(shl);    z_break;
     z_case(SHR)    binop(shr);    z_break;
-    z_case(EQ)     binop(eq);     z_break;
-    z_case(NE)     binop(ne);     z_break;
-    z_case(GT)     binop(gt);     z_break;
-    z_case(GE)     binop(ge);     z_break;
-    z_case(LT)     binop(lt);     z_break;
-    z_case(LE)     binop(le);     z_break;
+    z_case(EQ)     qbinop_int(eq, IEQ); z_break;
+    z_case(NE)     qbinop_int(ne, INE); z_break;
+    z_case(GT)     qbinop_int(gt, IGT); z_break;
+    z_case(GE)     qbinop_int(ge, IGE); z_break;
+    z_case(LT)     qbinop_int(lt, ILT); z_break;
+    z_case(LE)     qbinop_int(le, ILE); z_break;
     z_case(CAT)    binop(cat);    z_break;
     z_case(MATCH)  binop(match);  z_break;
     z_case(NMATCH) binop(nmatch); z_break;
 
+// Type-specialized binary operations
+// On a guard miss, revert to the generic instruction o and dispatch
+// it without advancing IP.
+#define ibinop(op,o) \
+    if (is_int(&sp[-2].v) && is_int(&sp[-1].v)) { \
+        assign_int(&sp[-2].v, as_int(&sp[-2].v) op as_int(&sp[-1].v)); \
+        --sp; \
+        ++ip; \
+    } else { \
+        set_op(o); \
+    }
+
+#define fbinop(op,o) \
+    if (is_flt(&sp[-2].v) && is_flt(&sp[-1].v)) { \
+        assign_flt(&sp[-2].v, as_flt(&sp[-2].v) op as_flt(&sp[-1].v)); \
+        --sp; \
+        ++ip; \
+    } else { \
+        set_op(o); \
+    }
+
+    z_case(IADD) ibinop(+,  ADD); z_break;
+    z_case(FADD) fbinop(+,  ADD); z_break;
+    z_case(ISUB) ibinop(-,  SUB); z_break;
+    z_case(FSUB) fbinop(-,  SUB); z_break;
+    z_case(IMUL) ibinop(*,  MUL); z_break;
+    z_case(FMUL) fbinop(*,  MUL); z_break;
+    z_case(IEQ)  ibinop(==, EQ);  z_break;
+    z_case(INE)  ibinop(!=, NE);  z_break;
+    z_case(IGT)  ibinop(>,  GT);  z_break;
+    z_case(IGE)  ibinop(>=, GE);  z_break;
+    z_case(ILT)  ibinop(<,  LT);  z_break;
+    z_case(ILE)  ibinop(<=, LE);  z_break;
+
 // Pre-increment/decrement
-// sp[-1].a is address of some variable's rf_val.
+// addr(sp[-1]) is address of some variable's rf_val.
 // Increment/decrement this value directly and replace the stack
 // element with a copy of the value.
 #define pre(x) \
-    switch (sp[-1].a->type) { \
-    case TYPE_INT: sp[-1].a->u.i += x; break; \
-    case TYPE_FLT: sp[-1].a->u.f += x; break; \
+    switch (type_of(addr(sp[-1]))) { \
+    case TYPE_INT: assign_int(addr(sp[-1]), as_int(addr(sp[-1])) + x); break; \
+    case TYPE_FLT: assign_flt(addr(sp[-1]), as_flt(addr(sp[-1])) + x); break; \
     case TYPE_STR: \
-        assign_flt(sp[-1].a, str2flt(sp[-1].a->u.s) + x); \
+        assign_flt(addr(sp[-1]), str2flt(as_str(addr(sp[-1]))) + x); \
         break; \
     default: \
-        assign_int(sp[-1].a, x); \
+        assign_int(addr(sp[-1]), x); \
         break; \
     } \
-    sp[-1].v = *sp[-1].a; \
+    wrote(addr(sp[-1])); \
+    sp[-1].v = *addr(sp[-1]); \
     ++ip;
 
     z_case(PREINC) pre(1);  z_break;
     z_case(PREDEC) pre(-1); z_break;
 
 // Post-increment/decrement
-// sp[-1].a is address of some variable's rf_val. Create a copy of
+// addr(sp[-1]) is address of some variable's rf_val. Create a copy of
 // the raw value, then increment/decrement the rf_val at the given
 // address.  Replace the stack element with the previously made copy
 // and coerce to a numeric value if needed.
 #define post(x) \
-    tp = sp[-1].a; \
+    tp = addr(sp[-1]); \
     sp[-1].v = *tp; \
-    switch (tp->type) { \
-    case TYPE_INT: tp->u.i += x; break; \
-    case TYPE_FLT: tp->u.f += x; break; \
+    switch (type_of(tp)) { \
+    case TYPE_INT: assign_int(tp, as_int(tp) + x); break; \
+    case TYPE_FLT: assign_flt(tp, as_flt(tp) + x); break; \
     case TYPE_STR: \
-        assign_flt(tp, str2flt(tp->u.s) + x); \
+        assign_flt(tp, str2flt(as_str(tp)) + x); \
         break; \
     default: \
         assign_int(tp, x); \
         break; \
     } \
+    wrote(tp); \
     unop(num);
 
     z_case(POSTINC) post(1);  z_break;
     z_case(POSTDEC) post(-1); z_break;
 
 // Compound assignment operations
-// sp[-2].a is address of some variable's rf_val. Save the address
+// addr(sp[-2]) is address of some variable's rf_val. Save the address
 // and place a copy of the value in sp[-2].v. Perform the binary
 // operation x and assign the result to the saved address.
 #define cbinop(x) \
-    tp = sp[-2].a; \
+    tp = addr(sp[-2]); \
     sp[-2].v = *tp; \
     binop(x); \
-    *tp = sp[-1].v;
+    *tp = sp[-1].v; \
+    wrote(tp);
+
+#define qcbinop(x,i,f) \
+    quicken(addr(sp[-2]), &sp[-1].v, i, f); \
+    cbinop(x);
 
-    z_case(ADDX) cbinop(add); z_break;
-    z_case(SUBX) cbinop(sub); z_break;
+    z_case(ADDX) qcbinop(add, IADDX, FADDX); z_break;
+    z_case(SUBX) qcbinop(sub, ISUBX, FSUBX); z_break;
     z_case(MULX) cbinop(mul); z_break;
     z_case(DIVX) cbinop(div); z_break;
     z_case(MODX) cbinop(mod); z_break;
@@ -716,21 +1130,55 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
     z_case(SHRX) cbinop(shr); z_break;
     z_case(XORX) cbinop(xor); z_break;
 
+// Type-specialized compound assignment operations
+#define icbinop(op,o) \
+    tp = addr(sp[-2]); \
+    if (is_int(tp) && is_int(&sp[-1].v)) { \
+        assign_int(tp, as_int(tp) op as_int(&sp[-1].v)); \
+        wrote(tp); \
+        sp[-2].v = *tp; \
+        --sp; \
+        ++ip; \
+    } else { \
+        set_op(o); \
+    }
+
+#define fcbinop(op,o) \
+    tp = addr(sp[-2]); \
+    if (is_flt(tp) && is_flt(&sp[-1].v)) { \
+        assign_flt(tp, as_flt(tp) op as_flt(&sp[-1].v)); \
+        wrote(tp); \
+        sp[-2].v = *tp; \
+        --sp; \
+        ++ip; \
+    } else { \
+        set_op(o); \
+    }
+
+    z_case(IADDX) icbinop(+, ADDX); z_break;
+    z_case(FADDX) fcbinop(+, ADDX); z_break;
+    z_case(ISUBX) icbinop(-, SUBX); z_break;
+    z_case(FSUBX) fcbinop(-, SUBX); z_break;
+
     // Simple pop operation
     z_case(POP) --sp; ++ip; z_break;
 
     // Pop IP+1 values from stack
-    z_case(POPI) sp -= ip[1]; ip += 2; z_break;
+    z_case(POPI) sp -= opnd(1); ip += 2; z_break;
 
     // Push null literal on stack
-    z_case(NULL) assign_null(&sp++->v); ++ip; z_break;
+    z_case(NULL)
+        stack_check(1);
+        assign_null(&sp++->v);
+        ++ip;
+        z_break;
 
 // Push immediate
 // Assign integer value x to the top of the stack.
-#define imm(x) assign_int(&sp++->v, x);
+#define imm(x) stack_check(1); assign_int(&sp++->v, x);
 
-    z_case(IMM8)  imm(ip[1]);              ip += 2; z_break;
-    z_case(IMM16) imm((ip[1]<<8) + ip[2]); ip += 3; z_break;
+    z_case(IMM8)  imm(opnd(1)); ip += 2; z_break;
+    z_case(IMM16) imm(opnd16);  ip += 3; z_break;
     z_case(IMM0)  imm(0);                  ++ip;    z_break;
     z_case(IMM1)  imm(1);                  ++ip;    z_break;
     z_case(IMM2)  imm(2);                  ++ip;    z_break;
@@ -738,67 +1186,115 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
 // Push constant
 // Copy constant x from code object's constant table to the top of the
 // stack.
-#define pushk(x) sp++->v = c->k[(x)];
+#define pushk(x) stack_check(1); sp++->v = c->k[(x)];
 
-    z_case(PUSHK)  pushk(ip[1]); ip += 2; z_break;
-    z_case(PUSHK0) pushk(0);     ++ip;    z_break;
-    z_case(PUSHK1) pushk(1);     ++ip;    z_break;
-    z_case(PUSHK2) pushk(2);     ++ip;    z_break;
+    z_case(PUSHK)  pushk(opnd(1)); ip += 2; z_break;
+    z_case(PUSHK0) pushk(0);       ++ip;    z_break;
+    z_case(PUSHK1) pushk(1);       ++ip;    z_break;
+    z_case(PUSHK2) pushk(2);       ++ip;    z_break;
 
 // Push global address
-// Assign the address of global variable x's rf_val in the globals
-// table.
-// h_lookup() will create an entry if needed, accommodating
-// undeclared/uninitialized variable usage.
+// Push the address of the rf_val in global slot x. Slots are resolved
+// at compile time (see c_global()); every slot exists (null) from the
+// start, accommodating undeclared/uninitialized variable usage.
 // Parser signals for this opcode for assignment or pre/post ++/--.
-#define gbla(x) sp++->a = h_lookup(&globals, c->k[(x)].u.s, 1);
+#define gbla(x) stack_check(1); set_addr(*sp++, &globals[(x)]);
 
-    z_case(GBLA)  gbla(ip[1]); ip += 2; z_break;
-    z_case(GBLA0) gbla(0);     ++ip;    z_break;
-    z_case(GBLA1) gbla(1);     ++ip;    z_break;
-    z_case(GBLA2) gbla(2);     ++ip;    z_break;
+    z_case(GBLA)   gbla(opnd(1)); ip += 2; z_break;
+    z_case(GBLA16) gbla(opnd16); ip += 3; z_break;
+    z_case(GBLA0)  gbla(0);       ++ip;    z_break;
+    z_case(GBLA1)  gbla(1);       ++ip;    z_break;
+    z_case(GBLA2)  gbla(2);       ++ip;    z_break;
 
 // Push global value
-// Copy the value of global variable x to the top of the stack.
-// h_lookup() will create an entry if needed, accommodating
-// undeclared/uninitialized variable usage.
+// Copy the value of global slot x to the top of the stack.
 // Parser signals for this opcode to be used when only needing the
 // value, e.g. arithmetic.
-#define gblv(x) sp++->v = *h_lookup(&globals, c->k[(x)].u.s, 0);
+#define gblv(x) stack_check(1); sp++->v = globals[(x)];
 
-    z_case(GBLV)  gblv(ip[1]); ip += 2; z_break;
-    z_case(GBLV0) gblv(0);     ++ip;    z_break;
-    z_case(GBLV1) gblv(1);     ++ip;    z_break;
-    z_case(GBLV2) gblv(2);     ++ip;    z_break;
+    z_case(GBLV)   gblv(opnd(1)); ip += 2; z_break;
+    z_case(GBLV16) gblv(opnd16); ip += 3; z_break;
+    z_case(GBLV0)  gblv(0);       ++ip;    z_break;
+    z_case(GBLV1)  gblv(1);       ++ip;    z_break;
+    z_case(GBLV2)  gblv(2);       ++ip;    z_break;
 
 // Push local address
 // Push the address of FP[x] to the top of the stack.
-#define lcla(x) sp++->a = &fp[(x)].v;
+#define lcla(x) stack_check(1); set_addr(*sp++, &fp[(x)].v);
 
-    z_case(LCLA)  lcla(ip[1]) ip += 2; z_break;
-    z_case(LCLA0) lcla(0);    ++ip;    z_break;
-    z_case(LCLA1) lcla(1);    ++ip;    z_break;
-    z_case(LCLA2) lcla(2);    ++ip;    z_break;
+    z_case(LCLA)  lcla(opnd(1)) ip += 2; z_break;
+    z_case(LCLA0) lcla(0);      ++ip;    z_break;
+    z_case(LCLA1) lcla(1);      ++ip;    z_break;
+    z_case(LCLA2) lcla(2);      ++ip;    z_break;
 
 // Push local value
 // Copy the value of FP[x] to the top of the stack.
-#define lclv(x) sp++->v = fp[(x)].v;
-
-    z_case(LCLV)  lclv(ip[1]) ip += 2; z_break;
-    z_case(LCLV0) lclv(0);    ++ip;    z_break;
-    z_case(LCLV1) lclv(1);    ++ip;    z_break;
-    z_case(LCLV2) lclv(2);    ++ip;    z_break;
-
+#define lclv(x) stack_check(1); sp++->v = fp[(x)].v;
+
+    z_case(LCLV)  lclv(opnd(1)) ip += 2; z_break;
+    z_case(LCLV0) lclv(0);      ++ip;    z_break;
+    z_case(LCLV1) lclv(1);      ++ip;    z_break;
+    z_case(LCLV2) lclv(2);      ++ip;    z_break;
+
+// Local +/- immediate (OP_LCLV x; OP_IMM y; OP_ADD/OP_SUB)
+// Push the result of FP[IP+1] op IP+2.
+#define lcli(x,op) \
+    stack_check(1); \
+    sp->v = fp[opnd(1)].v; \
+    if (is_int(&sp->v)) { \
+        assign_int(&sp->v, as_int(&sp->v) op opnd(2)); \
+    } else { \
+        rf_val imm = v_int(opnd(2)); \
+        z_##x(&sp->v, &imm); \
+    } \
+    ++sp; \
+    ip += 3;
+
+    z_case(ADDLI) lcli(add, +); z_break;
+    z_case(SUBLI) lcli(sub, -); z_break;
+
+
+// Call the C function at SP-nargs-1 with `nargs` arguments. Most
+// library functions are somewhat variadic; their arity refers to the
+// minimum number of arguments they require, and any missing ones are
+// nullified. SP is decremented to serve as the FP for the call, and
+// library functions assign their own return values to SP-1.
+//
+// TODO - hacky
+// If the callee returns 0 and the next instruction is PRINT1, skip
+// over the instruction. This facilitates user functions which
+// conditionally return something.
+#define call_cfn(nargs) { \
+    c_fn *fn = as_cfn(&sp[-(nargs)-1].v); \
+    int arity = fn->arity; \
+    if (arity && (nargs) < arity) { \
+        stack_check(arity); \
+        for (int i = (nargs); i < arity; ++i) { \
+            assign_null(&sp[i].v); \
+        } \
+    } \
+    sp -= (nargs); \
+    int nret = fn->fn(&sp->v, (nargs)); \
+    ip += 2; \
+    if (!nret) { \
+        assign_null(&sp[-1].v); \
+        if (op_is(PRINT1)) { \
+            ++ip; \
+            --sp; \
+        } \
+    } \
+}
 
     // Tailcalls
     // Recycle current call frame
     z_case(TCALL) {
-        int nargs = ip[1] + 1;
+        gc_check();
+        int nargs = opnd(1) + 1;
         if (!is_fn(&sp[-nargs].v))
             err("attempt to call non-function value");
         if (is_rfn(&sp[-nargs].v)) {
             sp -= nargs;
-            rf_fn *fn = sp->v.u.fn;
+            rf_fn *fn = as_rfn(&sp->v);
             int ar1 = sp - fp - 1;  // Current frame's "arity"
             int ar2 = fn->arity;    // Callee's arity
 
@@ -819,13 +1315,14 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
             // adjustments needed, quickly reset IP and dispatch
             // control
             if (c == fn->code && ar1 == ar2) {
-                ip = c->code;
+                ip = entry(c);
                 z_break;
             }
 
             // If callee's arity is larger than the current frame,
             // create stack space and nullify slots
             if (ar2 > ar1) {
+                stack_check(ar2 - ar1);
                 while (ar1++ < ar2)
                     assign_null(&sp++->v);
             }
@@ -840,38 +1337,42 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
             // the user didn't provide enough arguments, create stack
             // space and nullify slots
             else if (nargs <= ar2) {
+                stack_check(ar2 - nargs + 1);
                 while (nargs++ <= ar2)
                     assign_null(&sp++->v);
             }
             c  = fn->code;
-            ip = c->code;
+            ip = entry(c);
             z_break;
         }
 
-        // Fall-through to OP_CALL for C function calls
+        // C functions are called the same as with OP_CALL
+        call_cfn(opnd(1));
+        z_break;
     }
 
-    // Calling convention Arguments are pushed in-order following the
+    // Calling convention: Arguments are pushed in-order following the
     // rf_val containing a pointer to the function to be called.
-    // Caller sets SP and FP to appropriate positions and cleans up
-    // stack afterward. Callee returns from exec() the number of
-    // values to be returned to the caller.
+    // Calls to user-defined functions save the caller's state on the
+    // call frame stack and transfer control to the callee; the
+    // caller's stack is cleaned up by OP_RET/OP_RET1. C functions
+    // return the number of values returned to the caller.
     z_case(CALL) {
-        int nargs = ip[1];
+        gc_check();
+        int nargs = opnd(1);
         if (!is_fn(&sp[-nargs-1].v))
             err("attempt to call non-function value");
 
-        int arity, nret;
-
         // User-defined functions
         if (is_rfn(&sp[-nargs-1].v)) {
 
-            rf_fn *fn = sp[-nargs-1].v.u.fn;
-            arity = fn->arity;
+            rf_fn *fn = as_rfn(&sp[-nargs-1].v);
+            int arity = fn->arity;
 
             // If user called function with too few arguments,
             // nullify stack slots and increment SP.
             if (nargs < arity) {
+                stack_check(arity - nargs);
                 for (int i = nargs; i < arity; ++i) {
                     assign_null(&sp++->v);
                 }
@@ -884,51 +1385,48 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
                 sp -= (nargs - arity);
             }
 
-            // Pass SP-arity-1 as the FP for the succeeding call
-            // frame. Since the function is already at this location
-            // in the stack, the compiler can reserve the slot to
-            // accommodate any references a named function makes to
-            // itself without any other work required from the VM
-            // here. This is completely necessary for local named
-            // functions, but globals benefit as well.
-            nret = exec(fn->code, sp, sp - arity - 1);
-            sp -= arity;
-
-            // Copy the function's return value to the stack top -
-            // this should be where the caller pushed the original
-            // function.
-            sp[-1].v = sp[arity].v;
+            // Save the caller's state
+            m_growarray(frames.f, frames.n, frames.cap, rf_frame);
+            frames.f[frames.n++] = (rf_frame) {c, ip, fp};
+
+            // Use SP-arity-1 as the FP for the succeeding call frame.
+            // Since the function is already at this location in the
+            // stack, the compiler can reserve the slot to accommodate
+            // any references a named function makes to itself without
+            // any other work required from the VM here. This is
+            // completely necessary for local named functions, but
+            // globals benefit as well.
+            fp = sp - arity - 1;
+            c  = fn->code;
+            ip = entry(c);
+            z_break;
         }
             
         // Built-in/C functions
-        else {
-            c_fn *fn = sp[-nargs-1].v.u.cfn;
-            arity = fn->arity;
-
-            // Most library functions are somewhat variadic; their
-            // arity refers to the minimum number of arguments
-            // they require.
-            if (arity && nargs < arity) {
-                // If user called function with too few arguments,
-                // nullify stack slots.
-                for (int i = nargs; i < arity; ++i) {
-                    assign_null(&sp[i].v);
-                }
-            }
-            // Decrement SP to serve as the FP for the function
-            // call. Library functions assign their own return
-            // values to SP-1.
-            sp -= nargs;
-            nret = fn->fn(&sp->v, nargs);
-        }
-        ip += 2;
-        // TODO - hacky
-        // If callee returns 0 and the next instruction is PRINT1,
-        // skip over the instruction. This facilitates user
-        // functions which conditionally return something.
-        if (!nret) { 
+        call_cfn(nargs);
+        z_break;
+    }
+
+    // Return from a user-defined function. The caller expects the
+    // return value in the slot where it pushed the original function
+    // (FP[0]); "clean up" any created locals by copying the return
+    // value there and restoring the caller's state. Returning from
+    // the main chunk exits the interpreter loop.
+    z_case(RET) z_case(RET1) {
+        int nret = op_is(RET1);
+        if (!frames.n)
+            return nret;
+        if (nret)
+            fp->v = sp[-1].v;
+        sp = fp + 1;
+        rf_frame *f = &frames.f[--frames.n];
+        c  = f->c;
+        ip = f->ip + 2;
+        fp = f->fp;
+        // See OP_CALL
+        if (!nret) {
             assign_null(&sp[-1].v);
-            if (*ip == OP_PRINT1) {
+            if (op_is(PRINT1)) {
                 ++ip;
                 --sp;
             }
@@ -936,55 +1434,58 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
         z_break;
     }
 
+// Store the address `a` of a slot of table `t` in stack element `s`
+#define set_slot(s, t, a) \
+    owner[(s) - stack] = (t); \
+    set_addr(*(s), (a));
 
-    z_case(RET) return 0;
-
-    // Caller expects return value to be at its original SP +
-    // arity of the function. "clean up" any created locals by
-    // copying the return value to the appropriate slot.
-    z_case(RET1)
-        retp->v = sp[-1].v;
-        return 1;
+// Record that stack slots from s up may receive addresses of table
+// slots (see move_slots())
+#define watch_slots(s) \
+    if ((s) - stack < lo) \
+        lo = (s) - stack; \
+    top = sp - stack;
 
 // Create a sequential table of x elements from the top
 // of the stack. Leave the table rf_val on the stack.
 // Tables index at 0 by default.
-#define new_tbl(x) \
-    tp = v_newtbl(); \
+#define new_tbl(x) { \
+    rf_tbl *t = t_newtbl(); \
     for (int i = (x) - 1; i >= 0; --i) { \
         --sp; \
-        t_insert_int(tp->u.t, i, &sp->v, 1, 1); \
+        t_insert_int(t, i, &sp->v, 1); \
     } \
-    sp++->v = *tp;
+    sp++->v = v_tbl(t); \
+}
 
-    z_case(TBL0) new_tbl(0);    ++ip;    z_break;
-    z_case(TBL)  new_tbl(ip[1]) ip += 2; z_break;
+    z_case(TBL0) stack_check(1); new_tbl(0);    ++ip;    z_break;
+    z_case(TBL)  new_tbl(opnd(1)) ip += 2; z_break;
     z_case(TBLK)
-        new_tbl(c->k[ip[1]].u.i);
+        new_tbl(as_int(&c->k[opnd(1)]));
         ip += 2;
         z_break;
 
     z_case(IDXV)
-        for (int i = -ip[1] - 1; i < -1; ++i) {
-            if (sp[i].t <= TYPE_CFN) {
+        for (int i = -opnd(1) - 1; i < -1; ++i) {
+            if (!is_addr(sp[i])) {
                 z_idx(&sp[i].v, &sp[i+1].v);
                 sp[i+1].v = sp[i].v;
                 continue;
             }
-            switch (sp[i].a->type) {
+            switch (type_of(addr(sp[i]))) {
 
-            // Create array if sp[-2].a is an uninitialized variable
+            // Create array if addr(sp[-2]) is an uninitialized variable
             case TYPE_NULL:
-                *sp[i+1].a = *v_newtbl();
+                *addr(sp[i+1]) = v_tbl(t_newtbl());
                 // Fall-through
             case TYPE_TBL:
-                sp[i+1].v = *t_lookup(sp[i].a->u.t, &sp[i+1].v, 0);
+                sp[i+1].v = *t_lookup(as_tbl(addr(sp[i])), &sp[i+1].v, 0);
                 break;
 
             // Dereference and call z_idx().
             case TYPE_INT: case TYPE_FLT:
             case TYPE_STR: case TYPE_RFN:
-                sp[i].v = *sp[-i].a;
+                sp[i].v = *addr(sp[-i]);
                 z_idx(&sp[i].v, &sp[i+1].v);
                 sp[i+1].v = sp[i].v;
                 break;
@@ -994,26 +1495,29 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
                 break;
             }
         }
-        sp -= ip[1];
-        sp[-1].v = sp[ip[1] - 1].v;
+        sp -= opnd(1);
+        sp[-1].v = sp[opnd(1) - 1].v;
         ip += 2;
         z_break;
 
     z_case(IDXA)
-        for (int i = -ip[1] - 1; i < -1; ++i) {
-            if (sp[i].t <= TYPE_CFN)
+        watch_slots(sp - opnd(1) - 1);
+        for (int i = -opnd(1) - 1; i < -1; ++i) {
+            if (!is_addr(sp[i]))
                 tp = &sp[i].v;
             else
-                tp = sp[i].a;
+                tp = addr(sp[i]);
 
-            switch (tp->type) {
+            switch (type_of(tp)) {
 
-            // Create array if sp[i].a is an uninitialized variable
+            // Create array if addr(sp[i]) is an uninitialized variable
             case TYPE_NULL:
-                *tp = *v_newtbl();
+                *tp = v_tbl(t_newtbl());
                 // Fall-through
             case TYPE_TBL:
-                sp[i+1].a = t_lookup(tp->u.t, &sp[i+1].v, 1);
+                wrote(tp);
+                set_slot(sp + i + 1, as_tbl(tp), t_lookup(as_tbl(tp), &sp[i+1].v, 1));
+                will_write(as_tbl(tp), addr(sp[i+1]));
                 break;
 
             // IDXA is invalid for all other types
@@ -1021,8 +1525,8 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
                 err("invalid assignment");
             }
         }
-        sp -= ip[1];
-        sp[-1].a = sp[ip[1] - 1].a;
+        sp -= opnd(1);
+        set_slot(sp - 1, owner[sp + opnd(1) - 1 - stack], addr(sp[opnd(1) - 1]));
         ip += 2;
         z_break;
 
@@ -1030,21 +1534,24 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
     // Perform the lookup and leave the corresponding element's
     // rf_val address on the stack.
     z_case(IDXA1)
+        watch_slots(sp - 2);
 
         // Accomodate OP_IDXA calls when SP-2 is a raw value
-        if (sp[-2].t <= TYPE_CFN)
+        if (!is_addr(sp[-2]))
             tp = &sp[-2].v;
         else
-            tp = sp[-2].a;
+            tp = addr(sp[-2]);
 
-        switch (tp->type) {
+        switch (type_of(tp)) {
 
-        // Create array if sp[-2].a is an uninitialized variable
+        // Create array if addr(sp[-2]) is an uninitialized variable
         case TYPE_NULL:
-            *tp = *v_newtbl();
+            *tp = v_tbl(t_newtbl());
             // Fall-through
         case TYPE_TBL:
-            sp[-2].a = t_lookup(tp->u.t, &sp[-1].v, 1);
+            wrote(tp);
+            set_slot(sp - 2, as_tbl(tp), t_lookup(as_tbl(tp), &sp[-1].v, 1));
+            will_write(as_tbl(tp), addr(sp[-2]));
             break;
 
         // IDXA is invalid for all other types
@@ -1068,26 +1575,26 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
         // pointer), the high order 64 bits will be the type tag of
         // the rf_val instead of a memory address. When that happens,
         // defer to z_idx().
-        if (sp[-2].t <= TYPE_CFN) {
+        if (!is_addr(sp[-2])) {
             binop(idx);
             z_break;
         }
 
-        switch (sp[-2].a->type) {
+        switch (type_of(addr(sp[-2]))) {
 
-        // Create array if sp[-2].a is an uninitialized variable
+        // Create array if addr(sp[-2]) is an uninitialized variable
         case TYPE_NULL:
-            *sp[-2].a = *v_newtbl();
+            *addr(sp[-2]) = v_tbl(t_newtbl());
             // Fall-through
         case TYPE_TBL:
-            sp[-2].v = *t_lookup(sp[-2].a->u.t, &sp[-1].v, 0);
+            sp[-2].v = *t_lookup(as_tbl(addr(sp[-2])), &sp[-1].v, 0);
             --sp;
             ++ip;
             break;
 
         // Dereference and call z_idx().
         case TYPE_INT: case TYPE_FLT: case TYPE_STR: case TYPE_RFN:
-            sp[-2].v = *sp[-2].a;
+            sp[-2].v = *addr(sp[-2]);
             binop(idx);
             break;
         case TYPE_CFN:
@@ -1098,7 +1605,9 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
         z_break;
 
     z_case(FLDA)
-        sp[-1].a = t_lookup(&fldv, &sp[-1].v, 1);
+        watch_slots(sp - 1);
+        set_slot(sp - 1, &fldv, t_lookup(&fldv, &sp[-1].v, 1));
+        will_write(&fldv, addr(sp[-1]));
         ++ip;
         z_break;
 
@@ -1123,11 +1632,12 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
 // sequences).
 #define z_seq(f,t,i,s) { \
     rf_seq *seq = malloc(sizeof(rf_seq)); \
+    m_track(&seq->o, TYPE_SEQ); \
     rf_int from = seq->from = (f); \
     rf_int to   = seq->to = (t); \
     rf_int itvl = (i); \
     seq->itvl   = itvl ? itvl : from > to ? -1 : 1; \
-    s = (rf_val) {TYPE_SEQ, .u.q = seq}; \
+    s = v_seq(seq); \
 }
     // x..y
     z_case(SEQ)
@@ -1156,6 +1666,7 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
         z_break;
     // ..
     z_case(SEQE)
+        stack_check(1);
         ++sp;
         z_seq(0,
               INT64_MAX,
@@ -1202,11 +1713,21 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
     // Simple assignment
     // copy SP[-1] to *SP[-2] and leave value on stack.
     z_case(SET)
-        sp[-2].v = *sp[-2].a = sp[-1].v;
+        tp = addr(sp[-2]);
+        sp[-2].v = *tp = sp[-1].v;
+        wrote(tp);
         --sp;
         ++ip;
         z_break;
 
+    // Simple assignment; pop (OP_SET; OP_POP)
+    z_case(SETP)
+        *addr(sp[-2]) = sp[-1].v;
+        wrote(addr(sp[-2]));
+        sp -= 2;
+        ++ip;
+        z_break;
+
     // Print a single element from the stack
     z_case(PRINT1)
         z_print(&sp[-1].v);
@@ -1217,13 +1738,13 @@ static int exec(rf_code *c, rf_stack *sp, rf_stack *fp) {
 
     // Print (IP+1) elements from the stack
     z_case(PRINT)
-        for (int i = ip[1]; i > 0; --i) {
+        for (int i = opnd(1); i > 0; --i) {
             z_print(&sp[-i].v);
             if (i > 1)
                 printf(" ");
         }
         printf("\n");
-        sp -= ip[1];
+        sp -= opnd(1);
         ip += 2;
         z_break;
     z_case(EXIT)
@@ -4,15 +4,59 @@
 #include "code.h"
 #include "env.h"
 #include "hash.h"
+#include "table.h"
 #include "types.h"
 
+// VM dispatch method, selectable at build time (see makefile):
+//   VM_SWITCH    Standard while loop with switch/case
+//   VM_GOTO      Computed goto through a table of labels indexed by
+//                opcode
+//   VM_THREADED  Direct-threaded code; each code object is translated
+//                into label addresses and decoded operands before
+//                execution
+// Defaults to VM_THREADED if computed goto is available.
+#if !defined(VM_SWITCH) && !defined(VM_GOTO) && !defined(VM_THREADED)
+#ifdef __GNUC__
+#define VM_THREADED
+#else
+#define VM_SWITCH
+#endif
+#endif
+
+// Unit of code pointed to by the VM's IP
+#ifdef VM_THREADED
+typedef rf_word rf_inst;
+#else
+typedef uint8_t rf_inst;
+#endif
+
 // VM stack element
+//
+// A stack element holds either a value or the address of a variable's
+// rf_val (see OP_IDXA/OP_IDXV). With the default value layout, the
+// type tag of an rf_val is never greater than TYPE_CFN, while the
+// same word of an address is its (nonzero, aligned) pointer value.
+// NaN-boxed values instead tag addresses explicitly.
+#ifndef NAN_BOXING
 typedef union {
     uint64_t  t; // Implicit type tag
     rf_val   *a;
     rf_val    v;
 } rf_stack;
 
+#define is_addr(s)     ((s).t > TYPE_CFN)
+#define addr(s)        ((s).a)
+#define set_addr(s, p) ((s).a = (p))
+#else
+typedef union {
+    rf_val    v;
+} rf_stack;
+
+#define is_addr(s)     nb_is(&(s).v, NB_ADDR)
+#define addr(s)        ((rf_val *) nb_ptr(&(s).v))
+#define set_addr(s, p) ((s).v = nb_box(NB_ADDR, p))
+#endif
+
 enum loops {
     LOOP_SEQ,
     LOOP_STR,
@@ -24,22 +68,29 @@ typedef struct rf_iter rf_iter;
 
 // Loop iterator
 struct rf_iter {
-    rf_iter  *p;    // Previous loop iterator
     int       t;    // Loop type
     uint64_t  n;    // Control var
-    rf_int    on;   // Saved control var for freeing keys allocation
     rf_int    st;   // Start (for sequences)
+    rf_cursor cur;  // Traversal cursor (for tables)
     rf_val   *k;    // Stack slot for `k` in `[k,]v`
     rf_val   *v;    // Stack slot for `v` in `[k,]v`
-    rf_val   *keys; // Keys to look up tables with (fixed at loop start)
+    rf_val    sv;   // The set being iterated (GC root)
     union {
         rf_int      itvl;
-        const char *str;
+        rf_str     *str;
         uint8_t    *code;
         rf_tbl     *tbl;
     } set;
 };
 
+// Saved state of a suspended caller. Calls to user-defined functions
+// push one of these instead of recursing into the interpreter loop.
+typedef struct {
+    rf_code  *c;  // Caller's code object
+    rf_inst  *ip; // Caller's OP_CALL instruction
+    rf_stack *fp; // Caller's frame pointer
+} rf_frame;
+
 int  z_exec(rf_env *);
 
 #endif
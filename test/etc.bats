@@ -10,3 +10,82 @@
     run bin/riff -f test/eea.rf
     [ "$output" = "71" ]
 }
+
+@test "Ad hoc tests (garbage collection)" {
+    run bin/riff -f test/gc.rf
+    [ "$output" = "143 1250 998 neg3 deeper s100000 A,B,C, 40" ]
+}
+
+@test "Deep recursion grows the VM stack" {
+    run bin/riff 'fn f(n) { return n ? 1 + f(n-1) : 0 } f(100000)'
+    [ "$output" = "100000" ]
+}
+
+@test "Programs can reference more than 256 globals" {
+    f=$(for i in $(seq 0 199); do printf 'a%d = %d; ' $i $i; done)
+    g=$(for i in $(seq 0 199); do printf 'b%d = %d; ' $i $i; done)
+    run bin/riff "fn f() { $f } fn g() { $g } f(); g(); b199++; a199 # b150 # b199"
+    [ "$output" = "199150200" ]
+}
+
+@test "Counted loops over sequence literals" {
+    run bin/riff 'for i in 5..1:-2 { if i == 1 break; s = s # i # " " } for i in ..:3 { if i > 9 break; s = s # i # " " } s'
+    [ "$output" = "5 3 0 3 6 9 " ]
+}
+
+@test "Open-ended counted loops don't allocate" {
+    run bin/riff -s 'for i in ..:3 { if i > 3000000 break }'
+    n=$(echo "$output" | sed -n 's/.*collections: *//p')
+    [ "$n" -eq 0 ]
+}
+
+@test "Clearing table entries during iteration skips them" {
+    run bin/riff 't = {1,2,3,4}; t["x"] = 5; for k,v in t { t[k+1] = null; s = s # k # v # " " } s'
+    [ "$output" = "01 23 x5 " ]
+}
+
+@test "Assignments survive the array part growing mid-statement" {
+    run bin/riff 't = {}; t[0] = 1; t[0] = (t[1] = 2) + (t[9] = 3); u[1] = 1; u[9] = (u[2] = 2) + (u[3] = 3); t[0] # t[1] # t[9] # u[9]'
+    [ "$output" = "5235" ]
+}
+
+@test "Hash part keys keep their type" {
+    run bin/riff 't[-1] = 1; t["-1"] += 1; u[0.5] = 3; for k,v in t s = type(k) # k # v; for k,v in u s #= type(k) # k # v; s'
+    [ "$output" = "int-12float0.53" ]
+}
+
+@test "Table length tracks appends and deletions" {
+    run bin/riff 'for i in 1..10 t[#t] = i; t[3] = null; t[0]++; t["a"] = 1; t["a"] = null; t[20] += 1; t[1] = (t[2] = null); x = u[0] = 1; for i in 1..4 { y = u[#u] = i }; v = {}; v["k"] = (#v) + 1; #t # #u # #v'
+    [ "$output" = "851" ]
+}
+
+@test "Tables and functions are keyed by identity" {
+    run bin/riff 'f = fn() {}; a = {}; b = {}; t[f] = 1; t[sin] = 2; t[a] = 3; t[b] = 4; t[a] += 10; t[f] # t[sin] # t[a] # t[b] # #t'
+    [ "$output" = "121344" ]
+}
+
+@test "Float keys are exact and NaN is a single key" {
+    run bin/riff 'for i in 1..1000 t[i / 7] = i; n = 0/0; t[n] = 1; t[-n] += 1; t[-0.0] = 5; #t # t[1/7] # t[0] # t[n]'
+    [ "$output" = "1002152" ]
+}
+
+@test "String keys from different sources find the same entry" {
+    run bin/riff 'for i in 1..50 { t["k" # i % 5] += 1; u[split("a b")[i % 2] # ""]++ }; t["k3"] # t["k" # 3] # #t # u["a"] # u["b"]'
+    [ "$output" = "101052525" ]
+}
+
+@test "Strings built by repeated concatenation keep their prefixes" {
+    run bin/riff 's = ""; for i in 1..30 { s #= "abc"; t[i] = s }; u = t[20] # "x"; v = t[20] # "y"; a = #t[20]; b = #s; a # u[-1] # v[-1] # b # (t[20] == s[..59])'
+    [ "$output" = "60xy901" ]
+}
+
+@test "Strings may contain null bytes" {
+    run bin/riff 's = "a\x00b\x00\x00c"; t = split(s, "\x00"); u = gsub(s, "\x00", "-"); #s # #t # t[1] # #t[2] # u # (s # "" == s) # #fmt("%s", s) # (s ~ /c$/)'
+    [ "$output" = "64b0a-b--c161" ]
+}
+
+@test "Growing tables count towards the next collection" {
+    run bin/riff -s 'for i in 1..20 { t = {}; for j in 0..99999 t[-j] = j }'
+    n=$(echo "$output" | sed -n 's/.*collections: *//p')
+    [ "$n" -ge 10 ]
+}